@@ -0,0 +1,100 @@
+#!/usr/bin/env python3
+
+# Builds the bench env, runs it under simavr and writes the results as JSON:
+#
+#   ./bench.py -o bench.json
+#
+# {"mcu": "atmega328p", "f_cpu": 16000000, "overhead": 12,
+#  "benchmarks": {"crc16": {"runs": 16, "cycles": 1234, "min": 1234,
+#                           "max": 1234, "stack": 6}, ...}}
+#
+# Needs pio and simavr on the path.
+
+import argparse
+import json
+import re
+import subprocess
+import sys
+
+ELF = '.pio/build/bench/firmware.elf'
+MCU = 'atmega328p'
+
+RE_ANSI = re.compile(r'\x1b\[[0-9;]*m')
+RE_START = re.compile(r'bench start f_cpu (\d+) overhead (\d+)')
+RE_BENCH = re.compile(r'bench (\S+) runs (\d+) cycles (\d+) min (\d+) max (\d+) stack (\d+)')
+
+
+def build():
+    subprocess.run(['pio', 'run', '-e', 'bench'], check=True)
+
+
+def run(elf, f_cpu, timeout):
+    result = subprocess.run(['simavr', '-m', MCU, '-f', str(f_cpu), elf],
+                            stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+                            timeout=timeout)
+    return RE_ANSI.sub('', result.stdout.decode('ascii', 'replace'))
+
+
+def parse(output):
+    results = {'mcu': MCU, 'benchmarks': {}}
+    done = False
+
+    for line in output.splitlines():
+        match = RE_START.search(line)
+        if match:
+            results['f_cpu'] = int(match.group(1))
+            results['overhead'] = int(match.group(2))
+            continue
+
+        match = RE_BENCH.search(line)
+        if match:
+            name, runs, cycles, low, high, stack = match.groups()
+            results['benchmarks'][name] = {
+                'runs': int(runs),
+                'cycles': int(cycles),
+                'min': int(low),
+                'max': int(high),
+                'stack': int(stack),
+            }
+            continue
+
+        if 'bench done' in line:
+            done = True
+
+    return results, done
+
+
+def main():
+    parser = argparse.ArgumentParser(description='cycle counts of the firmware under simavr')
+    parser.add_argument('-o', '--output', help='JSON file to write, stdout if not given')
+    parser.add_argument('--no-build', action='store_true', help='use the ELF that is already there')
+    parser.add_argument('--elf', default=ELF)
+    parser.add_argument('--f-cpu', type=int, default=16000000)
+    parser.add_argument('--timeout', type=int, default=300, help='seconds to give simavr')
+    args = parser.parse_args()
+
+    if not args.no_build:
+        build()
+
+    output = run(args.elf, args.f_cpu, args.timeout)
+    results, done = parse(output)
+    if not done:
+        sys.stderr.write(output)
+        sys.stderr.write('the benchmarks didn\'t finish\n')
+        return 1
+
+    for name, bench in results['benchmarks'].items():
+        sys.stderr.write('%-16s %10u cycles %5u bytes stack\n' % (name, bench['cycles'], bench['stack']))
+
+    text = json.dumps(results, indent=2, sort_keys=True) + '\n'
+    if args.output:
+        with open(args.output, 'w') as f:
+            f.write(text)
+    else:
+        sys.stdout.write(text)
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -23,6 +23,7 @@
 
 #include <Arduino.h>
 #include "Entropy.h"
+#include "trace.h"
 
 const uint8_t WDT_MAX_8INT=0xFF;
 const uint16_t WDT_MAX_16INT=0xFFFF;
@@ -86,9 +87,9 @@ uint32_t EntropyClass::random(void)
     ;
   retVal = TRNG->TRNG_ODATA;
 #else
-  uint8_t waiting;
+  // yield() is empty on the AVR, the host build moves its clock on in it
   while (gWDT_pool_count < 1)
-    waiting += 1;
+    yield();
   ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
   {
     retVal = gWDT_entropy_pool[gWDT_pool_start];
@@ -133,8 +134,21 @@ uint16_t EntropyClass::random16(void)
   return(retVal16);
 }
 
+#if defined(NATIVE)
+static const uint8_t* g_forced;
+static size_t         g_forcedlen;
+#endif
+
 uint8_t EntropyClass::randomByte(void)
 {
+#if defined(NATIVE)
+  // the host build draws the challenges of a capture it replays again
+  if (g_forcedlen > 0)
+  {
+    g_forcedlen--;
+    return *g_forced++;
+  }
+#endif
   return random8();
 }
 
@@ -327,7 +341,9 @@ ISR(WDT_vect)
 #elif defined(__AVR__)
 ISR(WDT_vect)
 {
+  uint8_t start = LatencyISRStart();
   isr_hardware_neutral(TCNT1L); // Record the Timer 1 low byte (only one needed) 
+  LatencyISREnd(LATENCY_WDT, start);
 }
 
 #elif defined(__arm__) && defined(TEENSYDUINO)
@@ -337,6 +353,19 @@ void lptmr_isr(void)
   LPTMR0_CSR = 0b01000101;
   isr_hardware_neutral(SYST_CVR);
 }
+
+#elif defined(NATIVE)
+// The host build calls this where the watchdog interrupt would fire
+void SimEntropyTick(uint8_t val)
+{
+  isr_hardware_neutral(val);
+}
+
+void SimEntropyForce(const uint8_t* data, size_t len)
+{
+  g_forced = data;
+  g_forcedlen = len;
+}
 #endif
 
 // The library implements a single global instance.  There is no need, nor will the library 
@@ -39,6 +39,11 @@
 #include <util/atomic.h>
 #endif
 
+// The host build has its own ATOMIC_BLOCK
+#ifdef NATIVE
+#include <util/atomic.h>
+#endif
+
 const uint32_t WDT_RETURN_BYTE=256;
 const uint32_t WDT_RETURN_WORD=65536;
 
@@ -120,6 +120,9 @@ sample code bearing this copyright.
 */
 
 #include "OneWire.h"
+// the interrupts off windows are timed by LatencyIrqOff() and LatencyIrqOn()
+#include "trace.h"
+#include "capture.h"
 
 
 OneWire::OneWire(uint8_t pin)
@@ -127,6 +130,9 @@ OneWire::OneWire(uint8_t pin)
 	pinMode(pin, INPUT);
 	bitmask = PIN_TO_BITMASK(pin);
 	baseReg = PIN_TO_BASEREG(pin);
+#if ONEWIRE_CAPTURE
+	this->pin = pin;
+#endif
 #if ONEWIRE_SEARCH
 	reset_search();
 #endif
@@ -146,26 +152,30 @@ uint8_t OneWire::reset(void)
 	uint8_t r;
 	uint8_t retries = 125;
 
-	noInterrupts();
+	LatencyIrqOff();
 	DIRECT_MODE_INPUT(reg, mask);
-	interrupts();
+	LatencyIrqOn();
 	// wait until the wire is high... just in case
 	do {
-		if (--retries == 0) return 0;
+		if (--retries == 0) {
+			CaptureBusReset(pin, 0);
+			return 0;
+		}
 		delayMicroseconds(2);
 	} while ( !DIRECT_READ(reg, mask));
 
-	noInterrupts();
+	LatencyIrqOff();
 	DIRECT_WRITE_LOW(reg, mask);
 	DIRECT_MODE_OUTPUT(reg, mask);	// drive output low
-	interrupts();
+	LatencyIrqOn();
 	delayMicroseconds(480);
-	noInterrupts();
+	LatencyIrqOff();
 	DIRECT_MODE_INPUT(reg, mask);	// allow it to float
 	delayMicroseconds(70);
 	r = !DIRECT_READ(reg, mask);
-	interrupts();
+	LatencyIrqOn();
 	delayMicroseconds(410);
+	CaptureBusReset(pin, r);
 	return r;
 }
 
@@ -173,26 +183,26 @@ uint8_t OneWire::reset(void)
 // Write a bit. Port and bit is used to cut lookup time and provide
 // more certain timing.
 //
-void OneWire::write_bit(uint8_t v)
+void OneWire::write_slot(uint8_t v)
 {
 	IO_REG_TYPE mask=bitmask;
 	volatile IO_REG_TYPE *reg IO_REG_ASM = baseReg;
 
 	if (v & 1) {
-		noInterrupts();
+		LatencyIrqOff();
 		DIRECT_WRITE_LOW(reg, mask);
 		DIRECT_MODE_OUTPUT(reg, mask);	// drive output low
 		delayMicroseconds(10);
 		DIRECT_WRITE_HIGH(reg, mask);	// drive output high
-		interrupts();
+		LatencyIrqOn();
 		delayMicroseconds(55);
 	} else {
-		noInterrupts();
+		LatencyIrqOff();
 		DIRECT_WRITE_LOW(reg, mask);
 		DIRECT_MODE_OUTPUT(reg, mask);	// drive output low
 		delayMicroseconds(65);
 		DIRECT_WRITE_HIGH(reg, mask);	// drive output high
-		interrupts();
+		LatencyIrqOn();
 		delayMicroseconds(5);
 	}
 }
@@ -201,24 +211,37 @@ void OneWire::write_bit(uint8_t v)
 // Read a bit. Port and bit is used to cut lookup time and provide
 // more certain timing.
 //
-uint8_t OneWire::read_bit(void)
+uint8_t OneWire::read_slot(void)
 {
 	IO_REG_TYPE mask=bitmask;
 	volatile IO_REG_TYPE *reg IO_REG_ASM = baseReg;
 	uint8_t r;
 
-	noInterrupts();
+	LatencyIrqOff();
 	DIRECT_MODE_OUTPUT(reg, mask);
 	DIRECT_WRITE_LOW(reg, mask);
 	delayMicroseconds(3);
 	DIRECT_MODE_INPUT(reg, mask);	// let pin float, pull up will raise
 	delayMicroseconds(10);
 	r = DIRECT_READ(reg, mask);
-	interrupts();
+	LatencyIrqOn();
 	delayMicroseconds(53);
 	return r;
 }
 
+void OneWire::write_bit(uint8_t v)
+{
+	write_slot(v);
+	CaptureWriteBit(v & 1);
+}
+
+uint8_t OneWire::read_bit(void)
+{
+	uint8_t r = read_slot();
+	CaptureReadBit(r);
+	return r;
+}
+
 //
 // Write a byte. The writing code uses the active drivers to raise the
 // pin high, if you need power after the write (e.g. DS18S20 in
@@ -230,13 +253,14 @@ void OneWire::write(uint8_t v, uint8_t power /* = 0 */) {
     uint8_t bitMask;
 
     for (bitMask = 0x01; bitMask; bitMask <<= 1) {
-	OneWire::write_bit( (bitMask & v)?1:0);
+	OneWire::write_slot( (bitMask & v)?1:0);
     }
+    CaptureWriteByte(v);
     if ( !power) {
-	noInterrupts();
+	LatencyIrqOff();
 	DIRECT_MODE_INPUT(baseReg, bitmask);
 	DIRECT_WRITE_LOW(baseReg, bitmask);
-	interrupts();
+	LatencyIrqOn();
     }
 }
 
@@ -244,10 +268,10 @@ void OneWire::write_bytes(const uint8_t *buf, uint16_t count, bool power /* = 0
   for (uint16_t i = 0 ; i < count ; i++)
     write(buf[i]);
   if (!power) {
-    noInterrupts();
+    LatencyIrqOff();
     DIRECT_MODE_INPUT(baseReg, bitmask);
     DIRECT_WRITE_LOW(baseReg, bitmask);
-    interrupts();
+    LatencyIrqOn();
   }
 }
 
@@ -259,8 +283,9 @@ uint8_t OneWire::read() {
     uint8_t r = 0;
 
     for (bitMask = 0x01; bitMask; bitMask <<= 1) {
-	if ( OneWire::read_bit()) r |= bitMask;
+	if ( OneWire::read_slot()) r |= bitMask;
     }
+    CaptureReadByte(r);
     return r;
 }
 
@@ -291,9 +316,9 @@ void OneWire::skip()
 
 void OneWire::depower()
 {
-	noInterrupts();
+	LatencyIrqOff();
 	DIRECT_MODE_INPUT(baseReg, bitmask);
-	interrupts();
+	LatencyIrqOn();
 }
 
 #if ONEWIRE_SEARCH
@@ -379,8 +404,8 @@ uint8_t OneWire::search(uint8_t *newAddr)
       do
       {
          // read a bit and its complement
-         id_bit = read_bit();
-         cmp_id_bit = read_bit();
+         id_bit = read_slot();
+         cmp_id_bit = read_slot();
 
          // check for no devices on 1-wire
          if ((id_bit == 1) && (cmp_id_bit == 1))
@@ -419,7 +444,7 @@ uint8_t OneWire::search(uint8_t *newAddr)
               ROM_NO[rom_byte_number] &= ~rom_byte_mask;
 
             // serial number search direction write bit
-            write_bit(search_direction);
+            write_slot(search_direction);
 
             // increment the byte counter id_bit_number
             // and shift the mask rom_byte_mask
@@ -448,6 +473,9 @@ uint8_t OneWire::search(uint8_t *newAddr)
 
          search_result = TRUE;
       }
+
+      // the bits of a search take a lot of room, the capture keeps its result
+      CaptureSearch(ROM_NO, search_result && ROM_NO[0]);
    }
 
    // if no device found then reset counters so next 'search' will be like a first
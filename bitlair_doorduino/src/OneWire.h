@@ -45,6 +45,12 @@
 #define ONEWIRE_CRC16 1
 #endif
 
+// You can record every reset and every byte and bit on the bus in the
+// RAM ring of capture.h by defining this to 1
+#ifndef ONEWIRE_CAPTURE
+#define ONEWIRE_CAPTURE 0
+#endif
+
 #define FALSE 0
 #define TRUE  1
 
@@ -115,6 +121,18 @@
 #define DIRECT_WRITE_LOW(base, mask)    ((*(base+8+1)) = (mask))          //LATXCLR  + 0x24
 #define DIRECT_WRITE_HIGH(base, mask)   ((*(base+8+2)) = (mask))          //LATXSET + 0x28
 
+#elif defined(NATIVE)
+// the host build, the simulated pins see every change of the line
+#define PIN_TO_BASEREG(pin)             (0)
+#define PIN_TO_BITMASK(pin)             (pin)
+#define IO_REG_TYPE unsigned int
+#define IO_REG_ASM
+#define DIRECT_READ(base, pin)          ((void)(base), digitalRead(pin))
+#define DIRECT_WRITE_LOW(base, pin)     ((void)(base), digitalWrite(pin, LOW))
+#define DIRECT_WRITE_HIGH(base, pin)    ((void)(base), digitalWrite(pin, HIGH))
+#define DIRECT_MODE_INPUT(base, pin)    ((void)(base), pinMode(pin,INPUT))
+#define DIRECT_MODE_OUTPUT(base, pin)   ((void)(base), pinMode(pin,OUTPUT))
+
 #else
 #define PIN_TO_BASEREG(pin)             (0)
 #define PIN_TO_BITMASK(pin)             (pin)
@@ -136,6 +154,14 @@ class OneWire
     IO_REG_TYPE bitmask;
     volatile IO_REG_TYPE *baseReg;
 
+#if ONEWIRE_CAPTURE
+    uint8_t pin;
+#endif
+
+    // the slots without the capture, the bytes are captured as a whole
+    void write_slot(uint8_t v);
+    uint8_t read_slot(void);
+
 #if ONEWIRE_SEARCH
     // global search state
     unsigned char ROM_NO[8];
@@ -0,0 +1,266 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <Arduino.h>
+#include <avr/sleep.h>
+
+#include "../Entropy.h"
+#include "../OneWire.h"
+#include "../ds1961.h"
+#include "../leds.h"
+#include "../logger.h"
+#include "../mem.h"
+#include "../sha1.h"
+#include "../store.h"
+
+// The benchmarks of the bench env, for simavr, see bench.py. Every benchmark
+// prints one line:
+//
+//   bench <name> runs <n> cycles <avg> min <min> max <max> stack <bytes>
+//
+// Cycles are counted by timer 1 at the CPU clock, less what reading it costs.
+// Stack is the deepest the stack got below where the benchmark was called,
+// interrupts that came in during it included. Timer 0 and the watchdog are
+// stopped during the benchmarks that don't need them, so their interrupts
+// don't end up in the count. What a benchmark needs to be ready, like a word
+// in the entropy pool, is done before each run and isn't counted.
+
+#define BENCH_NAMESIZE         16
+
+namespace sha1
+{
+  void sha1_hashBlock(sha1nfo *s);
+}
+
+extern DS1961 ibutton;
+bool AuthenticateButton(DS1961* ibutton, uint8_t* addr);
+bool GetHexWordFromCMD(char* cmdbuf, uint8_t cmdbuffill, uint8_t* wordpos, uint8_t* wordbuf, uint8_t wordsize, const char* wordname);
+
+extern uint8_t __heap_start;
+extern char*   __brkval;
+
+typedef void (*benchfunc)();
+
+struct benchmark
+{
+  PGM_P     name;
+  benchfunc func;
+  benchfunc prepare;    // runs before each run, not counted, may be NULL
+  uint8_t   runs;
+  bool      interrupts; // needs millis() and the watchdog
+};
+
+static volatile uint16_t g_overflows;
+static uint16_t          g_overhead;
+
+static sha1::sha1nfo     g_sha1;
+static uint8_t           g_data[36];  // what an authenticated page read checks
+static volatile uint16_t g_result;
+static char              g_cmd[] = "add_button 335634120000006b 0011223344556677";
+static uint8_t           g_word[STORE_ADDRSIZE];
+static uint8_t           g_id[STORE_ADDRSIZE] = { 0x33, 0x56, 0x34, 0x12, 0x00, 0x00, 0x00, 0x6b };
+
+/*
+ * AuthenticateButton() runs against these instead of the EEPROM and the
+ * reader, the bench env links them in with --wrap. The MAC they give is never
+ * right, checking it takes as long as checking a right one.
+ */
+extern "C" bool __wrap__Z14StoreGetSecretPKhPh(const uint8_t* addr, uint8_t* secret)
+{
+  (void)addr;
+  memset(secret, 0x5A, STORE_SECRETSIZE);
+  return true;
+}
+
+extern "C" bool __wrap__ZN6DS196121ReadAuthWithChallengeEPKhjS1_PhS2_(DS1961* ibutton, const uint8_t* id, uint16_t addr,
+                                                                      const uint8_t* challenge, uint8_t* data, uint8_t* mac)
+{
+  (void)ibutton;
+  (void)id;
+  (void)addr;
+  (void)challenge;
+  memset(data, 0, 32);
+  memset(mac, 0, 20);
+  return true;
+}
+
+static void BenchSha1Block()
+{
+  sha1::sha1_hashBlock(&g_sha1);
+}
+
+static void BenchCrc16()
+{
+  g_result = OneWire::crc16(g_data, sizeof(g_data));
+}
+
+static void BenchCrc8()
+{
+  g_result = OneWire::crc8(g_data, 7);
+}
+
+static void BenchLEDTick()
+{
+  LEDTick();
+}
+
+static void BenchHexWord()
+{
+  uint8_t wordpos = 0;
+  g_result = GetHexWordFromCMD(g_cmd, sizeof(g_cmd) - 1, &wordpos, g_word, sizeof(g_word), "address");
+}
+
+// the watchdog adds a word to the pool every half second, AuthenticateButton()
+// would wait for it otherwise, as ReaderTask() doesn't scan without one
+static void WaitEntropy()
+{
+  while (!Entropy.available())
+    ;
+}
+
+static void BenchAuth()
+{
+  AuthenticateButton(&ibutton, g_id);
+}
+
+static const char g_name_sha1block[] PROGMEM = "sha1_hashblock";
+static const char g_name_crc16[]     PROGMEM = "crc16";
+static const char g_name_crc8[]      PROGMEM = "crc8";
+static const char g_name_ledtick[]   PROGMEM = "ledtick";
+static const char g_name_hexword[]   PROGMEM = "hexword";
+static const char g_name_auth[]      PROGMEM = "auth";
+
+static const benchmark g_benchmarks[] PROGMEM =
+{
+  { g_name_sha1block, BenchSha1Block, NULL,        16, false },
+  { g_name_crc16,     BenchCrc16,     NULL,        16, false },
+  { g_name_crc8,      BenchCrc8,      NULL,        16, false },
+  { g_name_ledtick,   BenchLEDTick,   NULL,        64, false },
+  { g_name_hexword,   BenchHexWord,   NULL,        16, false },
+  { g_name_auth,      BenchAuth,      WaitEntropy, 4,  true  },
+};
+
+ISR(TIMER1_OVF_vect)
+{
+  g_overflows++;
+}
+
+// timer 1 counts every cycle, its overflows make it 32 bits, nothing else
+// needs it as long as the LEDs aren't initialized
+static void CyclesInit()
+{
+  TCCR1A = 0;
+  TCCR1B = _BV(CS10);
+  TIMSK1 = _BV(TOIE1);
+}
+
+static uint32_t Cycles()
+{
+  uint8_t sreg = SREG;
+  cli();
+  uint16_t low = TCNT1;
+  uint16_t high = g_overflows;
+  //an overflow that came in after interrupts went off
+  if ((TIFR1 & _BV(TOV1)) && low < 0x8000)
+    high++;
+  SREG = sreg;
+
+  return ((uint32_t)high << 16) | low;
+}
+
+static void Run(const benchmark* bench)
+{
+  char name[BENCH_NAMESIZE];
+  strncpy_P(name, bench->name, sizeof(name) - 1);
+  name[sizeof(name) - 1] = 0;
+
+  uint8_t timsk0 = TIMSK0;
+  uint8_t wdtcsr = WDTCSR;
+  if (!bench->interrupts)
+  {
+    TIMSK0 = 0;
+    WDTCSR = wdtcsr & ~_BV(WDIE);
+  }
+
+  //paint the free RAM, everything below the stack pointer the benchmark
+  //touches is stack it used
+  uint8_t* heaptop = __brkval ? (uint8_t*)__brkval : &__heap_start;
+  uint8_t* stacktop = (uint8_t*)SP;
+  for (uint8_t* p = heaptop; p < stacktop; p++)
+    *p = MEM_PAINT;
+
+  uint32_t sum = 0;
+  uint32_t min = UINT32_MAX;
+  uint32_t max = 0;
+  for (uint8_t i = 0; i < bench->runs; i++)
+  {
+    if (bench->prepare)
+      bench->prepare();
+
+    uint32_t start = Cycles();
+    bench->func();
+    uint32_t cycles = Cycles() - start - g_overhead;
+
+    sum += cycles;
+    if (cycles < min)
+      min = cycles;
+    if (cycles > max)
+      max = cycles;
+  }
+
+  const uint8_t* p = heaptop;
+  while (p < stacktop && *p == MEM_PAINT)
+    p++;
+
+  if (!bench->interrupts)
+  {
+    WDTCSR = wdtcsr;
+    TIMSK0 = timsk0;
+  }
+
+  LogAlways("bench %s runs %u cycles %lu min %lu max %lu stack %u", name, bench->runs,
+            (unsigned long)(sum / bench->runs), (unsigned long)min, (unsigned long)max, (unsigned int)(stacktop - p));
+
+  //the UART interrupt must not run into the next benchmark
+  LogFlush();
+  Serial.flush();
+}
+
+void setup()
+{
+  Serial.begin(115200);
+  LogInit();
+  Entropy.initialize();
+  SetLEDState(LEDState_Reading);
+
+  for (uint8_t i = 0; i < sizeof(g_data); i++)
+    g_data[i] = i * 7;
+  sha1::sha1_init(&g_sha1);
+  memcpy(g_sha1.buffer, g_data, sizeof(g_data));
+
+  CyclesInit();
+  uint32_t start = Cycles();
+  g_overhead = Cycles() - start;
+
+  LogAlways("bench start f_cpu %lu overhead %u", (unsigned long)F_CPU, g_overhead);
+  for (uint8_t i = 0; i < sizeof(g_benchmarks) / sizeof(g_benchmarks[0]); i++)
+  {
+    benchmark bench;
+    memcpy_P(&bench, &g_benchmarks[i], sizeof(bench));
+    Run(&bench);
+  }
+  LogAlways("bench done");
+  LogFlush();
+  Serial.flush();
+
+  //simavr stops on a sleep it can't wake up from
+  set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+  cli();
+  sleep_enable();
+  sleep_cpu();
+}
+
+void loop()
+{
+}
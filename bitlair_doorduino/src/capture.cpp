@@ -0,0 +1,310 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <Arduino.h>
+
+#include "capture.h"
+#include "logger.h"
+
+#if ONEWIRE_CAPTURE
+
+// A record is a tag byte, its type in the high nibble, and what follows it:
+#define REC_RESET              0x00  // presence in bit 0, then the pin, ms, little endian, and
+                                     // how often the transaction repeated
+#define REC_WRITE              0x10  // the count in the low nibble, then the bytes
+#define REC_READ               0x20
+#define REC_BITS               0x30  // the count in the low nibble, then 2 bits each, 4 to a byte,
+                                     // bit 1 set for a write, bit 0 the value
+#define REC_SEARCH             0x40  // found in bit 0, then the id
+#define REC_TYPE               0xF0
+#define REC_COUNT              0x0F
+#define REC_RESETSIZE          5
+#define REC_RESETPIN           1
+#define REC_RESETMS            2
+#define REC_RESETREPEATS       4
+#define REC_SEARCHSIZE         9
+
+static uint8_t  g_ring[CAPTURE_SIZE];
+static uint16_t g_tail;    // the oldest record
+static uint16_t g_used;
+static uint16_t g_last;    // the newest record, to add to
+static bool     g_haslast;
+static uint16_t g_prev;    // the reset of the transaction before the current one
+static bool     g_hasprev;
+static uint16_t g_cur;     // the reset of the current transaction
+static bool     g_hascur;
+static bool     g_held;
+
+static uint8_t RecordSize(uint8_t tag)
+{
+  uint8_t count = tag & REC_COUNT;
+  switch (tag & REC_TYPE)
+  {
+    case REC_RESET:
+      return REC_RESETSIZE;
+    case REC_BITS:
+      return 1 + (count + 3) / 4;
+    case REC_SEARCH:
+      return REC_SEARCHSIZE;
+    default:
+      return 1 + count;
+  }
+}
+
+static inline uint8_t& At(uint16_t pos)
+{
+  return g_ring[pos % CAPTURE_SIZE];
+}
+
+// drops the oldest records until len bytes fit
+static void Reserve(uint8_t len)
+{
+  while (CAPTURE_SIZE - g_used < len)
+  {
+    uint8_t size = RecordSize(At(g_tail));
+    if (g_tail == g_last)
+      g_haslast = false;
+    if (g_tail == g_prev)
+      g_hasprev = false;
+    if (g_tail == g_cur)
+      g_hascur = false;
+    g_tail = (g_tail + size) % CAPTURE_SIZE;
+    g_used -= size;
+  }
+}
+
+static void Put(uint8_t value)
+{
+  At(g_tail + g_used) = value;
+  g_used++;
+}
+
+static void Begin(uint8_t tag, uint8_t size)
+{
+  Reserve(size);
+  g_last = (g_tail + g_used) % CAPTURE_SIZE;
+  g_haslast = true;
+  Put(tag);
+}
+
+// the newest record if it has room for one more of type
+static bool CanAdd(uint8_t type)
+{
+  return g_haslast && (At(g_last) & REC_TYPE) == type && (At(g_last) & REC_COUNT) < REC_COUNT;
+}
+
+// a transaction that ended the same as the one before it, a button held
+// against the reader is searched over and over, only counts as a repeat
+static bool Repeated()
+{
+  if (!g_hasprev || !g_hascur || At(g_prev + REC_RESETREPEATS) == 0xFF)
+    return false;
+
+  uint16_t len = (g_cur + CAPTURE_SIZE - g_prev) % CAPTURE_SIZE;
+  if (g_used - (g_cur + CAPTURE_SIZE - g_tail) % CAPTURE_SIZE != len)
+    return false;
+
+  if (At(g_prev) != At(g_cur) || At(g_prev + REC_RESETPIN) != At(g_cur + REC_RESETPIN))
+    return false;
+
+  for (uint16_t i = REC_RESETSIZE; i < len; i++)
+  {
+    if (At(g_prev + i) != At(g_cur + i))
+      return false;
+  }
+
+  g_used -= len;
+  At(g_prev + REC_RESETREPEATS)++;
+  return true;
+}
+
+void CaptureBusReset(uint8_t pin, uint8_t presence)
+{
+  if (g_held)
+    return;
+
+  uint16_t ms = millis();
+
+  //a run of resets nobody answered is kept as its last one
+  if (!presence && g_haslast && At(g_last) == REC_RESET)
+  {
+    At(g_last + REC_RESETPIN) = pin;
+    At(g_last + REC_RESETMS) = ms;
+    At(g_last + REC_RESETMS + 1) = ms >> 8;
+    if (At(g_last + REC_RESETREPEATS) != 0xFF)
+      At(g_last + REC_RESETREPEATS)++;
+    return;
+  }
+
+  if (!Repeated())
+  {
+    g_prev = g_cur;
+    g_hasprev = g_hascur;
+  }
+
+  Begin(REC_RESET | (presence ? 1 : 0), REC_RESETSIZE);
+  Put(pin);
+  Put(ms);
+  Put(ms >> 8);
+  Put(0);
+
+  g_cur = g_last;
+  g_hascur = true;
+}
+
+static void AddByte(uint8_t type, uint8_t value)
+{
+  if (g_held)
+    return;
+
+  if (CanAdd(type))
+  {
+    Reserve(1);
+    At(g_last)++;
+  }
+  else
+  {
+    Begin(type | 1, 2);
+  }
+  Put(value);
+}
+
+void CaptureWriteByte(uint8_t value)
+{
+  AddByte(REC_WRITE, value);
+}
+
+void CaptureReadByte(uint8_t value)
+{
+  AddByte(REC_READ, value);
+}
+
+static void AddBit(uint8_t bit)
+{
+  if (g_held)
+    return;
+
+  if (!CanAdd(REC_BITS))
+  {
+    Begin(REC_BITS | 1, 2);
+    Put(bit);
+    return;
+  }
+
+  uint8_t count = At(g_last) & REC_COUNT;
+  if (count % 4 == 0)
+  {
+    Reserve(1);
+    Put(0);
+  }
+  At(g_last)++;
+  At(g_last + 1 + count / 4) |= bit << (count % 4 * 2);
+}
+
+void CaptureWriteBit(uint8_t bit)
+{
+  AddBit(0x02 | bit);
+}
+
+void CaptureReadBit(uint8_t bit)
+{
+  AddBit(bit);
+}
+
+void CaptureSearch(const uint8_t* id, uint8_t found)
+{
+  if (g_held)
+    return;
+
+  Begin(REC_SEARCH | (found ? 1 : 0), REC_SEARCHSIZE);
+  for (uint8_t i = 0; i < 8; i++)
+    Put(id[i]);
+}
+
+void CaptureHold()
+{
+  g_held = true;
+}
+
+void CapturePrint()
+{
+  LogAlways("capture begin %u of %u bytes%s", g_used, CAPTURE_SIZE, g_held ? " held" : "");
+
+  //the records before the first reset lost the start of their transaction
+  bool started = false;
+  uint16_t pos = g_tail;
+  uint16_t left = g_used;
+  while (left > 0)
+  {
+    uint8_t tag = At(pos);
+    uint8_t type = tag & REC_TYPE;
+    uint8_t count = tag & REC_COUNT;
+
+    if (type == REC_RESET)
+    {
+      started = true;
+      LogAlways("capture reset %u %u %u %u", At(pos + REC_RESETPIN), tag & 1,
+                (uint16_t)(At(pos + REC_RESETMS) | (At(pos + REC_RESETMS + 1) << 8)), At(pos + REC_RESETREPEATS));
+    }
+    else if (started && type == REC_SEARCH)
+    {
+      uint8_t id[8];
+      char hex[sizeof(id) * 2 + 1];
+      for (uint8_t i = 0; i < sizeof(id); i++)
+        id[i] = At(pos + 1 + i);
+      LogAlways("capture search %u %s", tag & 1, FormatHex(hex, id, sizeof(id)));
+    }
+    else if (started && type == REC_BITS)
+    {
+      char bits[REC_COUNT * 2 + 1];
+      for (uint8_t i = 0; i < count; i++)
+      {
+        uint8_t bit = At(pos + 1 + i / 4) >> (i % 4 * 2);
+        bits[i * 2] = bit & 0x02 ? 'w' : 'r';
+        bits[i * 2 + 1] = '0' + (bit & 1);
+      }
+      bits[count * 2] = 0;
+      LogAlways("capture bits %s", bits);
+    }
+    else if (started)
+    {
+      uint8_t data[REC_COUNT];
+      char hex[REC_COUNT * 2 + 1];
+      for (uint8_t i = 0; i < count; i++)
+        data[i] = At(pos + 1 + i);
+      LogAlways("capture %c %s", type == REC_WRITE ? 'w' : 'r', FormatHex(hex, data, count));
+    }
+
+    uint8_t size = RecordSize(tag);
+    pos += size;
+    left -= size;
+  }
+
+  LogAlways("capture end");
+}
+
+void CaptureClear()
+{
+  g_tail = 0;
+  g_used = 0;
+  g_haslast = false;
+  g_hasprev = false;
+  g_hascur = false;
+  g_held = false;
+  LogAlways("capture cleared");
+}
+
+#else
+
+void CapturePrint()
+{
+  LogError("capture isn't built in, build with ONEWIRE_CAPTURE=1");
+}
+
+void CaptureClear()
+{
+  CapturePrint();
+}
+
+#endif
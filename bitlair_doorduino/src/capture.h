@@ -0,0 +1,55 @@
+#ifndef _CAPTURE_H_
+#define _CAPTURE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "OneWire.h"
+
+// A transcript of the 1-Wire buses in a RAM ring, for the failures that only
+// happen in the field. With ONEWIRE_CAPTURE set to 1 (the capture env) OneWire
+// records every reset with its presence pulse and every byte and bit it
+// writes and reads. The capture command dumps it, capture reset clears it:
+//
+//   capture begin <used> of <size> bytes [held]
+//   capture reset <pin> <presence> <ms> <repeats>
+//   capture w <hex>                       bytes written
+//   capture r <hex>                       bytes read
+//   capture bits r0w1...                  single bits read and written
+//   capture search <found> <hex>          the id a search found, instead of its bits
+//   capture end
+//
+// ms is the low 16 bits of millis(). A full ring drops the oldest records,
+// the dump starts at the first reset left. A transaction the same as the one
+// before it, like the search of a button held against the reader, and a run
+// of resets nobody answered only count repeats, up to 255, so polling
+// doesn't push the last touch out. A read that failed on every retry holds
+// the ring until capture reset, so it is still there when someone comes to
+// look. --replay of the host build plays a dump back to the firmware.
+
+#ifndef CAPTURE_SIZE
+#define CAPTURE_SIZE           256
+#endif
+
+#if ONEWIRE_CAPTURE
+void CaptureBusReset(uint8_t pin, uint8_t presence);
+void CaptureWriteByte(uint8_t value);
+void CaptureReadByte(uint8_t value);
+void CaptureWriteBit(uint8_t bit);
+void CaptureReadBit(uint8_t bit);
+void CaptureSearch(const uint8_t* id, uint8_t found);
+void CaptureHold();
+#else
+#define CaptureBusReset(pin, presence)
+#define CaptureWriteByte(value)
+#define CaptureReadByte(value)
+#define CaptureWriteBit(bit)
+#define CaptureReadBit(bit)
+#define CaptureSearch(id, found)
+#define CaptureHold()
+#endif
+
+void CapturePrint();
+void CaptureClear();
+
+#endif /* _CAPTURE_H_ */
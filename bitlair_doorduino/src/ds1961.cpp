@@ -4,6 +4,7 @@
 
 #include "OneWire.h"
 #include "ds1961.h"
+#include "sha1.h"
 
 // commands used in the DS1961 standard
 #define CMD_WRITE_SCRATCHPAD     0x0F
@@ -27,16 +28,49 @@
 #define T_CSHA                   2     // actually 1.5
 #define T_PROG                   10
 
+// what the last failing step ran into
+#define ERROR_PRESENCE           1
+#define ERROR_CRC                2
+#define ERROR_STATUS             3
+
+static uint8_t g_error;
+
+static bool Fail(uint8_t error)
+{
+  g_error = error;
+  return false;
+}
+
+static bool CheckCRC16(OneWire *ow, const uint8_t *data, uint16_t len, const uint8_t crc[2])
+{
+  if (!ow->check_crc16(data, len, crc)) {
+    return Fail(ERROR_CRC);
+  }
+
+  return true;
+}
+
+static bool CheckStatus(uint8_t status)
+{
+  if (status != 0xAA) {
+    return Fail(ERROR_STATUS);
+  }
+
+  return true;
+}
+
 
 DS1961::DS1961(OneWire *oneWire)
 {
   ow = oneWire;
+  retries = DS1961_RETRIES;
+  memset(&stats, 0, sizeof(stats));
 }
 
 static bool ResetAndSelect(OneWire *ow, const uint8_t id[8])
 {
   if (!ow->reset()) {
-    return false;
+    return Fail(ERROR_PRESENCE);
   }
   ow->select((uint8_t *) id);
   
@@ -63,7 +97,7 @@ static bool WriteScratchPad(OneWire *ow, const uint8_t id[8], uint16_t addr, con
   ow->write_bytes(buf, len);
   ow->read_bytes(crc, 2);
 
-  return ow->check_crc16(buf, len, crc);
+  return CheckCRC16(ow, buf, len, crc);
 }
 
 static bool RefreshScratchPad(OneWire *ow, const uint8_t id[8], uint16_t addr, const uint8_t data[8])
@@ -86,7 +120,7 @@ static bool RefreshScratchPad(OneWire *ow, const uint8_t id[8], uint16_t addr, c
   ow->write_bytes(buf, len);
   ow->read_bytes(crc, 2);
 
-  return ow->check_crc16(buf, len, crc);
+  return CheckCRC16(ow, buf, len, crc);
 }
 
 static bool ReadScratchPad(OneWire *ow, const uint8_t id[8], uint16_t *addr, uint8_t *es, uint8_t data[8])
@@ -117,7 +151,7 @@ static bool ReadScratchPad(OneWire *ow, const uint8_t id[8], uint16_t *addr, uin
 
   // check CRC
   ow->read_bytes(crc, 2);
-  return ow->check_crc16(buf, len, crc);
+  return CheckCRC16(ow, buf, len, crc);
 }
 
 static bool CopyScratchPad(OneWire *ow, const uint8_t id[8], uint16_t addr, uint8_t es, const uint8_t mac[20])
@@ -150,7 +184,7 @@ static bool CopyScratchPad(OneWire *ow, const uint8_t id[8], uint16_t addr, uint
   
   // check final status byte
   status = ow->read();
-  return (status == 0xAA);
+  return CheckStatus(status);
 }
 
 static bool ReadAuthPage(OneWire *ow, const uint8_t id[8], uint16_t addr, uint8_t data[32], uint8_t mac[20])
@@ -175,10 +209,10 @@ static bool ReadAuthPage(OneWire *ow, const uint8_t id[8], uint16_t addr, uint8_
   ow->read_bytes(buf + len, 33);
   len += 33;
   if (buf[35] != 0xFF) {
-    return false;
+    return Fail(ERROR_STATUS);
   }
   ow->read_bytes(crc, 2);
-  if (!ow->check_crc16(buf, len, crc)) {
+  if (!CheckCRC16(ow, buf, len, crc)) {
     return false;
   }
   memcpy(data, buf + 3, 32);
@@ -187,13 +221,13 @@ static bool ReadAuthPage(OneWire *ow, const uint8_t id[8], uint16_t addr, uint8_
   delay(T_CSHA);
   ow->read_bytes(mac, 20);
   ow->read_bytes(crc, 2);
-  if (!ow->check_crc16(mac, 20, crc)) {
+  if (!CheckCRC16(ow, mac, 20, crc)) {
     return false;
   }
 
   // check final status byte
   status = ow->read();
-  return (status == 0xAA);
+  return CheckStatus(status);
 }
 
 static bool LoadFirstSecret(OneWire *ow, const uint8_t id[8], uint16_t addr, uint8_t es)
@@ -214,7 +248,7 @@ static bool LoadFirstSecret(OneWire *ow, const uint8_t id[8], uint16_t addr, uin
   ow->depower();
   
   status = ow->read();
-  return (status == 0xAA);
+  return CheckStatus(status);
 }
 
 static bool ReadMemory(OneWire *ow, const uint8_t id[8], int addr, int len, uint8_t data[])
@@ -235,7 +269,7 @@ static bool ReadMemory(OneWire *ow, const uint8_t id[8], int addr, int len, uint
   return true;
 }
 
-bool DS1961::ReadAuthWithChallenge(const uint8_t id[8], uint16_t addr, const uint8_t challenge[3], uint8_t data[32], uint8_t mac[20])
+static bool ReadAuthOnce(OneWire *ow, const uint8_t id[8], uint16_t addr, const uint8_t challenge[3], uint8_t data[32], uint8_t mac[20])
 {
   uint8_t scratchpad[8];
 
@@ -243,42 +277,96 @@ bool DS1961::ReadAuthWithChallenge(const uint8_t id[8], uint16_t addr, const uin
   memset(scratchpad, 0, sizeof(scratchpad));
   memcpy(scratchpad + 4, challenge, 3);
   if (!WriteScratchPad(ow, id, addr, scratchpad)) {
-//        Serial.println("WriteScratchPad failed!");
     return false;
   }
 
   // perform the authenticated read
-  if (!ReadAuthPage(ow, id, addr, data, mac)) {
-//        Serial.println("ReadAuthPage failed!");
-    return false;
-  }
-
-  return true;
+  return ReadAuthPage(ow, id, addr, data, mac);
 }
 
-bool DS1961::WriteSecret(const uint8_t id[8], const uint8_t secret[8])
+static bool WriteSecretOnce(OneWire *ow, const uint8_t id[8], const uint8_t secret[8])
 {
   uint16_t addr;
   uint8_t es;
   uint8_t data[8];
-  
+
   // write secret to scratch pad
   if (!WriteScratchPad(ow, id, MEM_SECRET, secret)) {
-//    Serial.println("WriteScratchPad failed!");
     return false;
   }
-  
+
   // read scratch pad for auth code
   if (!ReadScratchPad(ow, id, &addr, &es, data)) {
-//    Serial.println("ReadScratchPad failed!");
     return false;
   }
-  if (!LoadFirstSecret(ow, id, addr, es)) {
-//    Serial.println("LoadFirstSecret failed!");
-    return false;
+
+  return LoadFirstSecret(ow, id, addr, es);
+}
+
+void DS1961::CountError()
+{
+  if (g_error == ERROR_PRESENCE) {
+    stats.presence++;
+  } else if (g_error == ERROR_CRC) {
+    stats.crc++;
+  } else if (g_error == ERROR_STATUS) {
+    stats.status++;
   }
+}
 
-  return true;
+/*
+ * Both of these start over with a reset, so a try that failed halfway leaves
+ * nothing behind that the next one depends on.
+ */
+bool DS1961::ReadAuthWithChallenge(const uint8_t id[8], uint16_t addr, const uint8_t challenge[3], uint8_t data[32], uint8_t mac[20])
+{
+  for (uint8_t i = 0; i <= retries; i++)
+  {
+    if (i > 0) {
+      stats.retries++;
+    }
+
+    if (ReadAuthOnce(ow, id, addr, challenge, data, mac)) {
+      return true;
+    }
+    CountError();
+  }
+
+  stats.failures++;
+  return false;
+}
+
+bool DS1961::WriteSecret(const uint8_t id[8], const uint8_t secret[8])
+{
+  for (uint8_t i = 0; i <= retries; i++)
+  {
+    if (i > 0) {
+      stats.retries++;
+    }
+
+    if (WriteSecretOnce(ow, id, secret)) {
+      return true;
+    }
+    CountError();
+  }
+
+  stats.failures++;
+  return false;
+}
+
+void DS1961::SetRetries(uint8_t retries)
+{
+  this->retries = retries;
+}
+
+void DS1961::GetStats(ds1961stats* stats)
+{
+  *stats = this->stats;
+}
+
+void DS1961::ResetStats()
+{
+  memset(&stats, 0, sizeof(stats));
 }
 
 /*
@@ -323,3 +411,72 @@ bool DS1961::WriteData(const uint8_t id[8], int addr, const uint8_t data[8], con
   return true;
 }
 
+/*
+ * The DS1961 hashes the first half of the secret, the page, 0xFF x4, 0x40,
+ * the first 7 bytes of its id, the second half of the secret and the challenge,
+ * and leaves out the final addition of the initial SHA-1 state. It sends the
+ * result least significant byte first.
+ */
+void DS1961::ComputeMAC(const uint8_t id[8], const uint8_t secret[8], const uint8_t data[32], const uint8_t challenge[3], uint8_t mac[20])
+{
+  static const uint32_t initialstate[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+
+  sha1::sha1nfo sha1data = {};
+  sha1::sha1_init(&sha1data);
+  sha1::sha1_write(&sha1data, (const char*)secret, 4);
+  sha1::sha1_write(&sha1data, (const char*)data, 32);
+  sha1::sha1_writebyte(&sha1data, 0xff);
+  sha1::sha1_writebyte(&sha1data, 0xff);
+  sha1::sha1_writebyte(&sha1data, 0xff);
+  sha1::sha1_writebyte(&sha1data, 0xff);
+  sha1::sha1_writebyte(&sha1data, 0x40);
+  sha1::sha1_write(&sha1data, (const char*)id, 7);
+  sha1::sha1_write(&sha1data, (const char*)secret + 4, 4);
+  sha1::sha1_write(&sha1data, (const char*)challenge, 3);
+
+  uint8_t* hash = sha1::sha1_result(&sha1data);
+
+  for (uint8_t word = 0; word < 5; word++)
+  {
+    const uint8_t* h = hash + word * 4;
+    uint32_t value = ((uint32_t)h[0] << 24) | ((uint32_t)h[1] << 16) | ((uint32_t)h[2] << 8) | h[3];
+    value -= initialstate[word];
+
+    for (uint8_t i = 0; i < 4; i++)
+      mac[19 - word * 4 - i] = value >> (24 - i * 8);
+  }
+}
+
+/*
+ * Writes the secret, then reads page 0 back authenticated and checks its MAC.
+ * Every try changes the challenge, so a try can't pass on a stale MAC.
+ */
+bool DS1961::WriteSecretVerified(const uint8_t id[8], const uint8_t secret[8], const uint8_t challenge[3], uint8_t tries)
+{
+  uint8_t nonce[3];
+  uint8_t data[32];
+  uint8_t mac[20];
+  uint8_t expected[20];
+
+  memcpy(nonce, challenge, sizeof(nonce));
+
+  for (uint8_t i = 0; i < tries; i++)
+  {
+    nonce[0] = challenge[0] + i;
+
+    if (!WriteSecret(id, secret)) {
+      continue;
+    }
+
+    if (!ReadAuthWithChallenge(id, 0, nonce, data, mac)) {
+      continue;
+    }
+
+    ComputeMAC(id, secret, data, nonce, expected);
+    if (memcmp(mac, expected, sizeof(mac)) == 0) {
+      return true;
+    }
+  }
+
+  return false;
+}
@@ -0,0 +1,179 @@
+#include <stdint.h>
+#include <string.h>
+
+#include <Arduino.h>
+
+#include "events.h"
+#include "logger.h"
+
+#define EVENT_NAMESIZE         20
+#define EVENT_LINEMAX          54  // "event <seq> <millis> <name> <arg>\n" at its longest
+
+struct event
+{
+  uint32_t time;
+  uint8_t  code;
+  uint16_t arg;
+};
+
+// the slot of an event is its sequence number modulo the ring size
+static event    g_events[EVENT_RINGSIZE];
+static uint32_t g_eventseq;   // sequence number of the last posted event
+static uint32_t g_eventsent;  // sequence number of the last event written to the log
+
+static const char g_name_boot[]          PROGMEM = "boot";
+static const char g_name_auth_ok[]       PROGMEM = "auth_ok";
+static const char g_name_auth_denied[]   PROGMEM = "auth_denied";
+static const char g_name_lock_opening[]  PROGMEM = "lock_opening";
+static const char g_name_lock_closing[]  PROGMEM = "lock_closing";
+static const char g_name_lock_done[]     PROGMEM = "lock_done";
+static const char g_name_solenoid_on[]   PROGMEM = "solenoid_on";
+static const char g_name_solenoid_off[]  PROGMEM = "solenoid_off";
+static const char g_name_horn_on[]       PROGMEM = "horn_on";
+static const char g_name_horn_off[]      PROGMEM = "horn_off";
+static const char g_name_button_added[]  PROGMEM = "button_added";
+static const char g_name_button_removed[] PROGMEM = "button_removed";
+static const char g_name_store_full[]    PROGMEM = "store_full";
+static const char g_name_openbutton_pressed[]  PROGMEM = "openbutton_pressed";
+static const char g_name_openbutton_released[] PROGMEM = "openbutton_released";
+static const char g_name_mains_lost[]    PROGMEM = "mains_lost";
+static const char g_name_mains_restored[] PROGMEM = "mains_restored";
+static const char g_name_store_error[]   PROGMEM = "store_error";
+
+static PGM_P const g_eventnames[EVENT_COUNT] PROGMEM =
+{
+  g_name_boot,
+  g_name_auth_ok,
+  g_name_auth_denied,
+  g_name_lock_opening,
+  g_name_lock_closing,
+  g_name_lock_done,
+  g_name_solenoid_on,
+  g_name_solenoid_off,
+  g_name_horn_on,
+  g_name_horn_off,
+  g_name_button_added,
+  g_name_button_removed,
+  g_name_store_full,
+  g_name_openbutton_pressed,
+  g_name_openbutton_released,
+  g_name_mains_lost,
+  g_name_mains_restored,
+  g_name_store_error,
+};
+
+// the lines the host parsed before there were events, kept for older scripts
+static const char g_legacy_auth_ok[]     PROGMEM = "iButton authenticated";
+static const char g_legacy_auth_denied[] PROGMEM = "iButton not authenticated";
+static const char g_legacy_opening[]     PROGMEM = "opening lock";
+static const char g_legacy_closing[]     PROGMEM = "closing lock";
+static const char g_legacy_lock_done[]   PROGMEM = "finished lock action";
+static const char g_legacy_solenoid[]    PROGMEM = "Solenoid activated";
+static const char g_legacy_horn[]        PROGMEM = "Horn activated";
+static const char g_legacy_mains_lost[]  PROGMEM = "Mains power lost";
+static const char g_legacy_mains_back[]  PROGMEM = "Mains power restored";
+
+static PGM_P const g_eventlegacy[EVENT_COUNT] PROGMEM =
+{
+  NULL,
+  g_legacy_auth_ok,
+  g_legacy_auth_denied,
+  g_legacy_opening,
+  g_legacy_closing,
+  g_legacy_lock_done,
+  g_legacy_solenoid,
+  NULL,
+  g_legacy_horn,
+  NULL,
+  NULL,
+  NULL,
+  NULL,
+  NULL,
+  NULL,
+  g_legacy_mains_lost,
+  g_legacy_mains_back,
+  NULL,
+};
+
+static PGM_P LegacyLine(const event* ev)
+{
+  if (ev->code == EVENT_AUTH_DENIED && ev->arg != EVENT_DENIED_LIMIT)
+    return NULL;
+
+  return (PGM_P)pgm_read_ptr(&g_eventlegacy[ev->code]);
+}
+
+static void SendEvent(uint32_t seq)
+{
+  const event* ev = &g_events[seq % EVENT_RINGSIZE];
+
+  char name[EVENT_NAMESIZE];
+  strncpy_P(name, (PGM_P)pgm_read_ptr(&g_eventnames[ev->code]), sizeof(name) - 1);
+  name[sizeof(name) - 1] = 0;
+
+  LogAlways("event %lu %lu %s %u", (unsigned long)seq, (unsigned long)ev->time, name, ev->arg);
+}
+
+void EventPost(uint8_t code, uint16_t arg)
+{
+  EventPostAt(code, millis(), arg);
+}
+
+void EventPostAt(uint8_t code, uint32_t time, uint16_t arg)
+{
+  g_eventseq++;
+
+  event* ev = &g_events[g_eventseq % EVENT_RINGSIZE];
+  ev->time = time;
+  ev->code = code;
+  ev->arg  = arg;
+
+  EventProcess();
+}
+
+void EventProcess()
+{
+  if (g_eventseq - g_eventsent > EVENT_RINGSIZE)
+  {
+    //the log ring was full for so long that the oldest ones were overwritten
+    uint32_t lost = g_eventseq - g_eventsent - EVENT_RINGSIZE;
+    g_eventsent += lost;
+    LogError("%lu events were overwritten before they were sent", (unsigned long)lost);
+  }
+
+  while (g_eventsent != g_eventseq)
+  {
+    const event* ev = &g_events[(g_eventsent + 1) % EVENT_RINGSIZE];
+    PGM_P legacy = LegacyLine(ev);
+
+    uint8_t len = EVENT_LINEMAX;
+    if (legacy)
+      len += strlen_P(legacy) + 1;
+    if (!LogFits(len))
+      return;
+
+    g_eventsent++;
+    if (legacy)
+      LogPrintf_P(LOGLEVEL_ALWAYS, legacy);
+    SendEvent(g_eventsent);
+  }
+}
+
+void EventReplaySince(uint32_t seq)
+{
+  uint32_t oldest = g_eventseq >= EVENT_RINGSIZE ? g_eventseq - EVENT_RINGSIZE + 1 : 1;
+  if (seq < oldest)
+  {
+    if (oldest > 1)
+      LogError("events before %lu are no longer available", (unsigned long)oldest);
+    seq = oldest;
+  }
+
+  for (; seq <= g_eventsent; seq++)
+    SendEvent(seq);
+}
+
+uint32_t EventLastSeq()
+{
+  return g_eventseq;
+}
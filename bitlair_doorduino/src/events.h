@@ -0,0 +1,64 @@
+#ifndef _EVENTS_H_
+#define _EVENTS_H_
+
+#include <stdint.h>
+
+// Every state change is sent to the host as one line:
+//
+//   event <seq> <millis> <name> <arg>
+//
+// seq starts at 1 after boot and increases by one per event, so the host can
+// tell a dropped line from a quiet door and ask for the missing ones with
+// replay_since. The last EVENT_RINGSIZE events are kept for that.
+//
+// Events that come with one of the older protocol lines, like "opening lock",
+// print that line just before the event line. Both are queued and only
+// written once the log ring has room for them, so posting one never waits on
+// the UART. They go out in order of seq on the next EventProcess().
+
+#define EVENT_BOOT             0
+#define EVENT_AUTH_OK          1   // arg: reader index
+#define EVENT_AUTH_DENIED      2   // arg: consecutive denied reads, up to EVENT_DENIED_LIMIT
+#define EVENT_LOCK_OPENING     3
+#define EVENT_LOCK_CLOSING     4
+#define EVENT_LOCK_DONE        5   // arg: 1 if the lock is now open
+#define EVENT_SOLENOID_ON      6   // arg: EVENT_SOURCE_*
+#define EVENT_SOLENOID_OFF     7
+#define EVENT_HORN_ON          8
+#define EVENT_HORN_OFF         9   // arg: ms the horn button was held
+#define EVENT_BUTTON_ADDED     10  // arg: eeprom slot
+#define EVENT_BUTTON_REMOVED   11  // arg: eeprom slot
+#define EVENT_STORE_FULL       12
+#define EVENT_OPENBUTTON_PRESSED  13
+#define EVENT_OPENBUTTON_RELEASED 14  // arg: ms the button was held
+#define EVENT_MAINS_LOST       15
+#define EVENT_MAINS_RESTORED   16
+#define EVENT_STORE_ERROR      17  // the EEPROM didn't answer a read or write
+#define EVENT_COUNT            18
+
+#define EVENT_DENIED_LIMIT     3   // denied reads that print "iButton not authenticated"
+
+#define EVENT_SOURCE_IBUTTON   0
+#define EVENT_SOURCE_INPUT     1
+
+#ifndef EVENT_RINGSIZE
+#define EVENT_RINGSIZE         16
+#endif
+
+void     EventPost(uint8_t code, uint16_t arg = 0);
+
+// Posts an event that happened at time, in millis(), earlier than it could
+// be posted, like a button edge the interrupt timestamped while the loop was
+// busy.
+void     EventPostAt(uint8_t code, uint32_t time, uint16_t arg = 0);
+
+// Writes the queued events that fit in the log ring, call it from the loop.
+void     EventProcess();
+
+// Resends every event still in the ring with a sequence number >= seq that
+// was already sent once, without the older protocol lines.
+void     EventReplaySince(uint32_t seq);
+
+uint32_t EventLastSeq();
+
+#endif /* _EVENTS_H_ */
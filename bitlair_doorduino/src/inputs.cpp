@@ -0,0 +1,232 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <Arduino.h>
+
+#include "inputs.h"
+#include "logger.h"
+#include "trace.h"
+#if defined(NATIVE)
+#include "sim.h"
+#endif
+
+#define INPUT_RINGMASK         (INPUT_RINGSIZE - 1)
+
+// keeps the compiler from moving ring accesses across the index updates
+#define COMPILER_BARRIER()     __asm__ __volatile__("" ::: "memory")
+
+struct input
+{
+#if defined(__AVR__)
+  volatile uint8_t* reg;
+  uint8_t           mask;
+  volatile uint8_t* outreg;     // NULL without an output
+  uint8_t           outmask;
+#else
+  uint8_t           pin;
+  uint8_t           outpin;     // NOT_A_PIN without an output
+#endif
+  volatile bool     pressed;    // debounced
+  uint32_t          lastedge;   // millis() at the last accepted edge
+};
+
+static input   g_inputs[INPUT_MAX];
+static uint8_t g_inputcount;
+
+// single producer (the interrupt), single consumer (the loop)
+static inputevent       g_inputring[INPUT_RINGSIZE];
+static volatile uint8_t g_inputhead;
+static volatile uint8_t g_inputtail;
+static volatile uint8_t g_inputoverflow;
+static volatile bool    g_inputwake;
+
+static bool ReadInput(const input* in)
+{
+#if defined(__AVR__)
+  return (*in->reg & in->mask) == 0;
+#else
+  return digitalRead(in->pin) == LOW;
+#endif
+}
+
+static void WriteOutput(const input* in, bool high)
+{
+#if defined(__AVR__)
+  if (!in->outreg)
+    return;
+
+  if (high)
+    *in->outreg |= in->outmask;
+  else
+    *in->outreg &= ~in->outmask;
+#else
+  if (in->outpin != NOT_A_PIN)
+    digitalWrite(in->outpin, high ? HIGH : LOW);
+#endif
+}
+
+// called with interrupts disabled
+static void InputEdge(uint8_t id, bool pressed, uint32_t now)
+{
+  input* in = &g_inputs[id];
+  uint32_t sincelast = now - in->lastedge;
+  if (pressed == in->pressed || sincelast < INPUT_DEBOUNCE)
+    return;
+
+  in->pressed = pressed;
+  in->lastedge = now;
+  WriteOutput(in, pressed);
+
+  uint8_t head = g_inputhead;
+  uint8_t next = (head + 1) & INPUT_RINGMASK;
+  if (next == g_inputtail)
+  {
+    g_inputoverflow++;
+    return;
+  }
+
+  inputevent* ev = &g_inputring[head];
+  ev->time = now;
+  ev->duration = sincelast > 0xFFFF ? 0xFFFF : sincelast;
+  ev->id = id;
+  ev->pressed = pressed;
+  COMPILER_BARRIER();
+  g_inputhead = next;
+}
+
+// the pin change interrupt, pins that are only enabled to wake the MCU up
+// fall through without an input attached
+static void InputPinChange()
+{
+  g_inputwake = true;
+
+  uint32_t now = millis();
+  for (uint8_t i = 0; i < g_inputcount; i++)
+    InputEdge(i, ReadInput(&g_inputs[i]), now);
+}
+
+void InputAdd(uint8_t id, uint8_t pin)
+{
+  input* in = &g_inputs[id];
+
+  pinMode(pin, INPUT_PULLUP);
+#if defined(__AVR__)
+  in->reg = portInputRegister(digitalPinToPort(pin));
+  in->mask = digitalPinToBitMask(pin);
+  in->outreg = NULL;
+#else
+  in->pin = pin;
+  in->outpin = NOT_A_PIN;
+#endif
+
+  noInterrupts();
+  in->pressed = ReadInput(in);
+  in->lastedge = millis() - INPUT_DEBOUNCE;
+  if (id >= g_inputcount)
+    g_inputcount = id + 1;
+  interrupts();
+
+#if defined(__AVR__)
+  *digitalPinToPCMSK(pin) |= _BV(digitalPinToPCMSKbit(pin));
+  PCICR |= _BV(digitalPinToPCICRbit(pin));
+#elif defined(NATIVE)
+  SimSetPinChange(InputPinChange);
+  SimPinChangeEnable(pin, true);
+#endif
+}
+
+void InputSetOutput(uint8_t id, uint8_t pin)
+{
+  input* in = &g_inputs[id];
+
+  pinMode(pin, OUTPUT);
+
+  noInterrupts();
+#if defined(__AVR__)
+  in->outreg = portOutputRegister(digitalPinToPort(pin));
+  in->outmask = digitalPinToBitMask(pin);
+#else
+  in->outpin = pin;
+#endif
+  WriteOutput(in, in->pressed);
+  interrupts();
+}
+
+bool InputNextEvent(inputevent* ev)
+{
+  uint8_t tail = g_inputtail;
+  if (tail == g_inputhead)
+    return false;
+
+  COMPILER_BARRIER();
+  *ev = g_inputring[tail];
+  COMPILER_BARRIER();
+  g_inputtail = (tail + 1) & INPUT_RINGMASK;
+
+  return true;
+}
+
+void InputWakeEnable(uint8_t pin, bool enable)
+{
+#if defined(__AVR__)
+  if (enable)
+  {
+    *digitalPinToPCMSK(pin) |= _BV(digitalPinToPCMSKbit(pin));
+    PCICR |= _BV(digitalPinToPCICRbit(pin));
+  }
+  else
+  {
+    *digitalPinToPCMSK(pin) &= ~_BV(digitalPinToPCMSKbit(pin));
+  }
+#elif defined(NATIVE)
+  SimPinChangeEnable(pin, enable);
+#endif
+}
+
+bool InputTakeWake()
+{
+  bool wake = g_inputwake;
+  g_inputwake = false;
+  return wake;
+}
+
+bool InputWakePending()
+{
+  return g_inputwake;
+}
+
+bool InputPressed(uint8_t id)
+{
+  return g_inputs[id].pressed;
+}
+
+void InputProcess()
+{
+  //an edge inside the debounce time is ignored, so a level that changed
+  //back and forth quickly is picked up here once that time has passed
+  for (uint8_t i = 0; i < g_inputcount; i++)
+  {
+    noInterrupts();
+    InputEdge(i, ReadInput(&g_inputs[i]), millis());
+    interrupts();
+  }
+
+  if (g_inputoverflow)
+  {
+    LogError("input ring overflow, dropped %u events", g_inputoverflow);
+    g_inputoverflow = 0;
+  }
+}
+
+#if defined(__AVR__)
+// one handler for all pin change interrupts
+ISR(PCINT0_vect)
+{
+  uint8_t start = LatencyISRStart();
+  InputPinChange();
+  LatencyISREnd(LATENCY_PCINT, start);
+}
+
+ISR(PCINT1_vect, ISR_ALIASOF(PCINT0_vect));
+ISR(PCINT2_vect, ISR_ALIASOF(PCINT0_vect));
+#endif
@@ -0,0 +1,58 @@
+#ifndef _INPUTS_H_
+#define _INPUTS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Push buttons read through pin change interrupts. The interrupt timestamps
+// every edge, debounces it by ignoring further edges for INPUT_DEBOUNCE ms and
+// queues the accepted ones in a ring that the loop empties with
+// InputNextEvent(). The buttons are active low.
+
+#ifndef INPUT_MAX
+#define INPUT_MAX              2
+#endif
+
+#ifndef INPUT_RINGSIZE
+#define INPUT_RINGSIZE         8   // must be a power of two
+#endif
+
+#define INPUT_DEBOUNCE         20  // ms
+
+struct inputevent
+{
+  uint32_t time;      // millis() at the edge
+  uint16_t duration;  // ms since the previous edge, so how long a released button was held
+  uint8_t  id;
+  bool     pressed;
+};
+
+// enables the pull up and the pin change interrupt for pin, id is the index
+// reported in events, counting up from 0
+void InputAdd(uint8_t id, uint8_t pin);
+
+// drives the output pin high while the input is pressed, from the interrupt,
+// so it follows the button even while the loop is busy
+void InputSetOutput(uint8_t id, uint8_t pin);
+
+// returns false when there are no more events
+bool InputNextEvent(inputevent* ev);
+
+// debounced state of an input
+bool InputPressed(uint8_t id);
+
+// enables or disables the pin change interrupt of a pin that is not an input,
+// so that activity on it wakes the MCU from sleep
+void InputWakeEnable(uint8_t pin, bool enable);
+
+// true if any pin change interrupt fired since the last call
+bool InputTakeWake();
+
+// same, but doesn't clear it
+bool InputWakePending();
+
+// catches up on a level change that happened while an input was being
+// debounced, call this regularly from the loop
+void InputProcess();
+
+#endif /* _INPUTS_H_ */
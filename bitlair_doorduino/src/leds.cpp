@@ -0,0 +1,139 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <Arduino.h>
+
+#include "leds.h"
+#include "trace.h"
+
+#define LED_PERIOD           1024  // ticks per fade in and out, a power of two
+#define LED_FADESTEPS        64    // entries in g_fadetable, half a period
+
+// brightness over half a period of the reading pattern, 255 * (i / 63)^2
+static const uint8_t g_fadetable[LED_FADESTEPS] PROGMEM =
+{
+    0,   0,   0,   1,   1,   2,   2,   3,   4,   5,   6,   8,   9,  11,  13,  14,
+   16,  19,  21,  23,  26,  28,  31,  34,  37,  40,  43,  47,  50,  54,  58,  62,
+   66,  70,  74,  79,  83,  88,  93,  98, 103, 108, 113, 119, 124, 130, 136, 142,
+  148, 154, 161, 167, 174, 180, 187, 194, 201, 209, 216, 224, 231, 239, 247, 255,
+};
+
+static volatile uint8_t  g_ledstate = LEDState_Off;
+static volatile bool     g_ledlockopen;
+static volatile bool     g_leddimmed;
+static volatile uint16_t g_ledphase;
+
+// last values written to the PWM registers
+static uint8_t g_ledgreen;
+static uint8_t g_ledred;
+
+static void LEDWrite(uint8_t pin, uint8_t value)
+{
+#if defined(__AVR_ATmega328P__)
+  if (pin == PIN_LEDGREEN)
+    OCR1B = value;
+  else
+    OCR2A = value;
+#else
+  analogWrite(pin, value);
+#endif
+}
+
+void LEDInit()
+{
+  pinMode(PIN_LEDGREEN, OUTPUT);
+  pinMode(PIN_LEDRED, OUTPUT);
+
+  //let the core connect the pins to their timers, after this only the compare registers are written
+  analogWrite(PIN_LEDGREEN, 1);
+  analogWrite(PIN_LEDRED, 1);
+  LEDWrite(PIN_LEDGREEN, 0);
+  LEDWrite(PIN_LEDRED, 0);
+
+#if defined(__AVR__)
+  //timer 0 overflows once per millis() tick, the compare match halfway adds an interrupt at the same rate
+  OCR0A = 0x80;
+  TIMSK0 |= _BV(OCIE0A);
+#endif
+}
+
+void SetLEDState(uint8_t ledstate)
+{
+  if (ledstate == g_ledstate)
+    return;
+
+  noInterrupts();
+  //the reading pattern starts at full brightness
+  if (ledstate == LEDState_Reading)
+    g_ledphase = LED_PERIOD / 2;
+  g_ledstate = ledstate;
+  interrupts();
+}
+
+void LEDSetLockOpen(bool lockopen)
+{
+  g_ledlockopen = lockopen;
+}
+
+void LEDSetDimmed(bool dimmed)
+{
+  g_leddimmed = dimmed;
+}
+
+void LEDTick()
+{
+  uint8_t green = 0;
+  uint8_t red = 0;
+
+  if (g_ledstate == LEDState_Reading)
+  {
+    uint16_t phase = (g_ledphase + 1) & (LED_PERIOD - 1);
+    g_ledphase = phase;
+
+    uint8_t step = phase / (LED_PERIOD / 2 / LED_FADESTEPS);
+    if (step >= LED_FADESTEPS)
+      step = (LED_FADESTEPS * 2 - 1) - step;
+
+    uint8_t value = pgm_read_byte(g_fadetable + step);
+    if (g_leddimmed)
+      value = ((uint16_t)value * 26 + 128) >> 8; //about a tenth
+
+    if (g_ledlockopen)
+      green = value;
+    else
+      red = value;
+  }
+  else if (g_ledstate == LEDState_Authorized)
+  {
+    if (g_ledlockopen)
+      green = 255;
+    else
+      red = 255;
+  }
+  else if (g_ledstate == LEDState_Busy)
+  {
+    green = 255;
+    red = 255;
+  }
+
+  if (green != g_ledgreen)
+  {
+    g_ledgreen = green;
+    LEDWrite(PIN_LEDGREEN, green);
+  }
+
+  if (red != g_ledred)
+  {
+    g_ledred = red;
+    LEDWrite(PIN_LEDRED, red);
+  }
+}
+
+#if defined(__AVR__)
+ISR(TIMER0_COMPA_vect)
+{
+  uint8_t start = LatencyISRStart();
+  LEDTick();
+  LatencyISREnd(LATENCY_TIMER0, start);
+}
+#endif
@@ -0,0 +1,34 @@
+#ifndef _LEDS_H_
+#define _LEDS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// The reader LEDs are rendered from the timer 0 compare A interrupt, which
+// fires once per millis() tick without disturbing millis() itself. The main
+// loop only selects what to show.
+//
+// Both LEDs must be on hardware PWM pins whose timer runs in phase correct
+// mode, so that 0 and 255 in the compare register give a steady off and on.
+
+#define PIN_LEDGREEN           10  // OC1B
+#define PIN_LEDRED             11  // OC2A
+
+#define LEDState_Off         0
+#define LEDState_Reading     1
+#define LEDState_Authorized  2
+#define LEDState_Busy        3
+
+void LEDInit();
+void SetLEDState(uint8_t ledstate);
+
+// selects green (open) or red (closed) for the reading and authorized patterns
+void LEDSetLockOpen(bool lockopen);
+
+// dims the reading pattern, used to save power on battery
+void LEDSetDimmed(bool dimmed);
+
+// renders one tick of about 1 ms, called from the timer interrupt
+void LEDTick();
+
+#endif /* _LEDS_H_ */
@@ -0,0 +1,182 @@
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "logger.h"
+
+#define LOG_RINGMASK           (LOG_RINGSIZE - 1)
+#define LOG_RESERVE            (LOG_RINGSIZE / 3)  // kept for LOGLEVEL_ALWAYS lines while not blocking
+
+#if !defined(__AVR__)
+#define LOG_LINEMAX            96  // only used where there is no vfprintf_P
+#endif
+
+static uint8_t  g_logring[LOG_RINGSIZE];
+static uint8_t  g_loghead;        // where the next byte is stored
+static uint8_t  g_logtail;        // next byte to send to the UART
+static uint8_t  g_loglinestart;   // start of the line being formatted
+static bool     g_logoverflow;    // the line being formatted didn't fit
+static bool     g_logkeep;        // the line being formatted is never dropped
+static uint16_t g_logdropped;
+static uint8_t  g_loglevel = LOGLEVEL_DEBUG;
+static bool     g_logblocking = true;
+
+static const char g_prefix_error[] PROGMEM = "ERROR: ";
+static const char g_prefix_info[]  PROGMEM = "INFO: ";
+static const char g_prefix_debug[] PROGMEM = "DEBUG: ";
+
+static void LogPutByte(uint8_t c)
+{
+  if (g_logoverflow)
+    return;
+
+  //the other lines leave the reserve free for protocol lines
+  uint8_t used = (g_loghead - g_logtail) & LOG_RINGMASK;
+  uint8_t next = (g_loghead + 1) & LOG_RINGMASK;
+  if (!g_logblocking && (next == g_logtail || (!g_logkeep && used >= LOG_RINGSIZE - LOG_RESERVE)))
+  {
+    //throw away what was stored of this line
+    g_logoverflow = true;
+    g_loghead = g_loglinestart;
+    return;
+  }
+
+  if (next == g_logtail)
+  {
+    //make room by pushing the oldest byte out, this waits if the TX buffer is full
+    Serial.write(g_logring[g_logtail]);
+    g_logtail = (g_logtail + 1) & LOG_RINGMASK;
+  }
+
+  g_logring[g_loghead] = c;
+  g_loghead = next;
+}
+
+static void LogPutString_P(PGM_P str)
+{
+  char c;
+  while ((c = pgm_read_byte(str++)) != 0)
+    LogPutByte(c);
+}
+
+#if defined(__AVR__)
+static FILE g_logstream;
+
+static int LogPutChar(char c, FILE* stream)
+{
+  LogPutByte(c);
+  return 0;
+}
+#endif
+
+void LogInit()
+{
+  g_loghead = 0;
+  g_logtail = 0;
+  g_logdropped = 0;
+
+#if defined(__AVR__)
+  fdev_setup_stream(&g_logstream, LogPutChar, NULL, _FDEV_SETUP_WRITE);
+#endif
+}
+
+void LogPrintf_P(uint8_t level, PGM_P fmt, ...)
+{
+  if (level > g_loglevel)
+    return;
+
+  g_loglinestart = g_loghead;
+  g_logoverflow = false;
+  g_logkeep = level == LOGLEVEL_ALWAYS;
+
+  if (level == LOGLEVEL_ERROR)
+    LogPutString_P(g_prefix_error);
+  else if (level == LOGLEVEL_INFO)
+    LogPutString_P(g_prefix_info);
+  else if (level == LOGLEVEL_DEBUG)
+    LogPutString_P(g_prefix_debug);
+
+  va_list args;
+  va_start(args, fmt);
+#if defined(__AVR__)
+  vfprintf_P(&g_logstream, fmt, args);
+#else
+  char buf[LOG_LINEMAX];
+  vsnprintf(buf, sizeof(buf), fmt, args);
+  for (char* c = buf; *c; c++)
+    LogPutByte(*c);
+#endif
+  va_end(args);
+
+  LogPutByte('\n');
+
+  if (g_logoverflow)
+    g_logdropped++;
+}
+
+void LogProcess()
+{
+  int room = Serial.availableForWrite();
+  while (room > 0 && g_logtail != g_loghead)
+  {
+    Serial.write(g_logring[g_logtail]);
+    g_logtail = (g_logtail + 1) & LOG_RINGMASK;
+    room--;
+  }
+
+  if (g_logdropped > 0 && g_logtail == g_loghead)
+  {
+    uint16_t dropped = g_logdropped;
+    g_logdropped = 0;
+    LogError("log ring overflow, dropped %u lines", dropped);
+  }
+}
+
+void LogFlush()
+{
+  while (g_logtail != g_loghead)
+  {
+    Serial.write(g_logring[g_logtail]);
+    g_logtail = (g_logtail + 1) & LOG_RINGMASK;
+  }
+}
+
+bool LogFits(uint8_t len)
+{
+  return g_logblocking || LOG_RINGSIZE - 1 - ((g_loghead - g_logtail) & LOG_RINGMASK) >= len;
+}
+
+void LogSetBlocking(bool blocking)
+{
+  g_logblocking = blocking;
+}
+
+void LogSetLevel(uint8_t level)
+{
+  if (level < LOGLEVEL_ERROR)
+    level = LOGLEVEL_ERROR;
+  else if (level > LOGLEVEL_DEBUG)
+    level = LOGLEVEL_DEBUG;
+
+  g_loglevel = level;
+}
+
+uint8_t LogGetLevel()
+{
+  return g_loglevel;
+}
+
+char* FormatHex(char* out, const uint8_t* data, uint8_t len)
+{
+  static const char hexdigits[] PROGMEM = "0123456789abcdef";
+
+  for (uint8_t i = 0; i < len; i++)
+  {
+    out[i * 2]     = pgm_read_byte(hexdigits + (data[i] >> 4));
+    out[i * 2 + 1] = pgm_read_byte(hexdigits + (data[i] & 0x0F));
+  }
+  out[len * 2] = 0;
+
+  return out;
+}
@@ -0,0 +1,71 @@
+#ifndef _LOGGER_H_
+#define _LOGGER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <Arduino.h>
+
+// Log lines are formatted from flash-resident format strings straight into a
+// RAM ring, which is drained to the UART from LogProcess() when the loop has
+// nothing better to do. Formatting never uses a line buffer on the stack.
+
+#define LOGLEVEL_ALWAYS        0   // protocol lines the host parses, never filtered
+#define LOGLEVEL_ERROR         1
+#define LOGLEVEL_INFO          2
+#define LOGLEVEL_DEBUG         3
+
+#ifndef LOG_RINGSIZE
+#define LOG_RINGSIZE           128 // must be a power of two, at most 256
+#endif
+
+#if defined(__AVR__)
+#define LOG_PRINTF(level, fmt, ...) \
+  ((0 ? LogCheckFormat(fmt, ##__VA_ARGS__) : (void)0), LogPrintf_P(level, PSTR(fmt), ##__VA_ARGS__))
+#else
+#define LOG_PRINTF(level, fmt, ...) LogPrintf_P(level, PSTR(fmt), ##__VA_ARGS__)
+#endif
+
+#define LogAlways(fmt, ...)    LOG_PRINTF(LOGLEVEL_ALWAYS, fmt, ##__VA_ARGS__)
+#define LogError(fmt, ...)     LOG_PRINTF(LOGLEVEL_ERROR, fmt, ##__VA_ARGS__)
+#define LogInfo(fmt, ...)      LOG_PRINTF(LOGLEVEL_INFO, fmt, ##__VA_ARGS__)
+#define LogDebug(fmt, ...)     LOG_PRINTF(LOGLEVEL_DEBUG, fmt, ##__VA_ARGS__)
+
+void    LogInit();
+
+// Appends one line, prefixed according to its level, to the ring. On the AVR
+// PSTR() hides the format from the compiler, so the macros above check it
+// against the arguments with LogCheckFormat(), which is never called.
+void    LogPrintf_P(uint8_t level, PGM_P fmt, ...) __attribute__ ((format (printf, 2, 3)));
+
+static inline void LogCheckFormat(const char* fmt, ...) __attribute__ ((format (printf, 1, 2)));
+static inline void LogCheckFormat(const char* fmt, ...)
+{
+  (void)fmt;
+}
+
+// Writes as much of the ring to the UART as fits in its TX buffer, never waits.
+void    LogProcess();
+
+// Writes out the whole ring, waiting on the UART if needed.
+void    LogFlush();
+
+// When blocking is off, lines that don't fit in the ring are dropped and
+// counted instead of waiting for the UART, and a part of the ring is kept
+// free for LOGLEVEL_ALWAYS lines. Turn it off on paths where a stalled TX
+// buffer must not delay anything, such as unlocking. Protocol lines on those
+// paths go through the event queue, see events.h, which holds them until
+// LogFits() says they can be written without being dropped.
+void    LogSetBlocking(bool blocking);
+
+// True when a line of len bytes, newline included, can be written now
+// without waiting or being dropped, always when blocking is on.
+bool    LogFits(uint8_t len);
+
+void    LogSetLevel(uint8_t level);
+uint8_t LogGetLevel();
+
+// Formats len bytes as lowercase hex into out, which must hold len * 2 + 1 chars.
+char*   FormatHex(char* out, const uint8_t* data, uint8_t len);
+
+#endif /* _LOGGER_H_ */
@@ -5,8 +5,17 @@
 #include <string.h>
 // #include <EEPROM.h>
 #include "Entropy.h"
-#include "sha1.h"
-#include "Wire.h"
+#include "logger.h"
+#include "events.h"
+#include "scheduler.h"
+#include "leds.h"
+#include "inputs.h"
+#include "power.h"
+#include "trace.h"
+#include "capture.h"
+#include "mem.h"
+#include "store.h"
+#include "twi.h"
 
 
 #include <Arduino.h>
@@ -23,6 +32,8 @@ A4988 stepper(MOTOR_STEPS, DIR, STEP);
 #define INPUT_HORN             3
 #define PIN_LEDSOLENOID        6
 #define PIN_LEDHORN            5
+#define INPUTID_SOLENOID       0
+#define INPUTID_HORN           1
 bool    StateSolenoid = false;
 bool    StateHorn = false;
 uint32_t SolenoidStartTime;
@@ -34,149 +45,104 @@ uint32_t SolenoidStartTime;
 #define PIN_HORN               A2
 #define PIN_OPEN               13
 #define PIN_CLOSE              A0
+#define PIN_DOORDONE           4   // pulled low by the door controller when its move is done
 
-#define PIN_1WIRE              8
-#define PIN_LEDGREEN           10
-#define PIN_LEDRED             11
-
-#define PIN_MAINS_POWER        2
+#define PIN_1WIRE              8   // outer reader
+#define PIN_1WIRE_INNER        12  // inner reader
 
 #define CMD_BUFSIZE            64
 #define CMD_TIMEOUT            10000 //command timeout in milliseconds
 
-#define SECRETSIZE             8
-#define ADDRSIZE               8
-#define STORAGESIZE            (SECRETSIZE + ADDRSIZE)
-#define EEPROMDEVICEADDRESS    0x50
-#define EEPROMSIZE             2048
+#define SECRETSIZE             STORE_SECRETSIZE
+#define ADDRSIZE               STORE_ADDRSIZE
 #define SHA1SIZE               20
 
 #define IBUTTON_SEARCH_TIMEOUT 60000 //timeout searching for ibutton
 
-#define LEDState_Off         0
-#define LEDState_Reading     1
-#define LEDState_Authorized  2
-#define LEDState_Busy        3
+// Every reader has its own 1-Wire bus, they all check buttons against the
+// same store in the EEPROM. A reader either toggles the lock, like the outer
+// one, or only fires the solenoid, like the inner one. There is one solenoid,
+// on the door both readers are at, so every solenoid reader fires that one.
+// As on the separate inner board, a known button opens it whatever the
+// spacestate, READER_SPACEOPEN is there for a reader that should not.
+#define READER_TOGGLE          0x01 // toggles the lock, otherwise only the solenoid
+#define READER_SPACEOPEN       0x02 // only reads while the spacestate is open
 
-#define htons(x) ( ((x)<<8) | (((x)>>8)&0xFF) )
-#define ntohs(x) htons(x)
+#ifndef READER_COUNT
+#define READER_COUNT           2
+#endif
 
-#define htonl(x) ( ((x)<<24 & 0xFF000000UL) | \
-                   ((x)<< 8 & 0x00FF0000UL) | \
-                   ((x)>> 8 & 0x0000FF00UL) | \
-                   ((x)>>24 & 0x000000FFUL) )
-#define ntohl(x) htonl(x)
+struct reader
+{
+  OneWire* bus;
+  DS1961*  ibutton;
+  uint8_t  pin;
+  uint8_t  policy;
+  uint8_t  deniedcount;
+};
 
 OneWire ds(PIN_1WIRE);
 DS1961  ibutton(&ds);
+#if READER_COUNT > 1
+OneWire dsinner(PIN_1WIRE_INNER);
+DS1961  ibuttoninner(&dsinner);
+#endif
 
-bool HasMainsPower();
-
-int Serialprintf (const char* fmt, ...) __attribute__ ((format (printf, 1, 2)));
-
-int Serialprintf (const char* fmt, ...)
+reader g_readers[READER_COUNT] =
 {
-  char buf[256];
-
-  va_list args;
-  va_start(args, fmt);
-  vsnprintf(buf, sizeof(buf), fmt, args);
-  va_end(args);
+  { &ds, &ibutton, PIN_1WIRE, READER_TOGGLE, 0 },
+#if READER_COUNT > 1
+  { &dsinner, &ibuttoninner, PIN_1WIRE_INNER, 0, 0 },
+#endif
+};
+
+void SerialTask();
+void ReaderTask();
+void LockTask();
+void SolenoidTask();
+void InputTask();
+void LogTask();
+void StepperTask();
+void PowerTask();
+void ApplyPowerMode();
+void StoreTask();
+
+#define TASK_SERIAL            0
+#define TASK_READER            1
+#define TASK_LOCK              2
+#define TASK_SOLENOID          3
+#define TASK_INPUTS            4
+#define TASK_LOG               5
+#define TASK_STEPPER           6
+#define TASK_POWER             7
+#define TASK_STORE             8
+
+#define READER_INTERVAL        1    // ms between 1-Wire searches on mains
+#define READER_INTERVAL_BATTERY 250 // and on battery, still well below a second to unlock
+#define POWER_INTERVAL         100
 
-  Serial.print(buf);
-}
 
-uint8_t  g_ledstate = LEDState_Off;
-uint32_t g_ledtimestart;
-bool     g_fade;
 bool     g_lockopen;
+bool     g_spacestate;  // true when the space is open, sent by the host
 
-#define LED_PERIOD 1024
-
-void ProcessLEDs()
-{
-  if (g_ledstate == LEDState_Off)
-  {
-    analogWrite(PIN_LEDGREEN, 0);
-    analogWrite(PIN_LEDRED, 0);
-  }
-  else if (g_ledstate == LEDState_Reading)
-  {
-    uint32_t timesincesetting = millis() + LED_PERIOD / 2 - g_ledtimestart;
-    uint32_t ledtime = timesincesetting % LED_PERIOD;
-    uint32_t ledval;
-    if (ledtime < LED_PERIOD / 2)
-      ledval = ledtime;
-    else
-      ledval = (LED_PERIOD - 1) - ledtime;
-
-    ledval = (ledval * ledval) / LED_PERIOD;
-    if (!HasMainsPower())
-      ledval = (ledval + 5) / 10;
-
-    if (g_lockopen)
-    {
-      analogWrite(PIN_LEDGREEN, ledval);
-      analogWrite(PIN_LEDRED, 0);
-    }
-    else
-    {
-      analogWrite(PIN_LEDGREEN, 0);
-      analogWrite(PIN_LEDRED, ledval);
-    }
-  }
-  else if (g_ledstate == LEDState_Authorized)
-  {
-    if (g_lockopen)
-    {
-      analogWrite(PIN_LEDGREEN, 255);
-      analogWrite(PIN_LEDRED, 0);
-    }
-    else
-    {
-      analogWrite(PIN_LEDGREEN, 0);
-      analogWrite(PIN_LEDRED, 255); 
-    }
-  }
-  else if (g_ledstate == LEDState_Busy)
-  {
-    analogWrite(PIN_LEDGREEN, 255);
-    analogWrite(PIN_LEDRED, 255);
-  }
-}
-
-void SetLEDState(uint8_t ledstate)
-{
-  if (ledstate == LEDState_Reading && g_ledstate != LEDState_Reading)
-  {
-    g_ledtimestart = millis();
-    g_fade = true;
-  }
-
-  g_ledstate = ledstate;
-
-  ProcessLEDs();
-}
-
-void DelayLEDs(uint32_t delayms)
-{
-  uint32_t now = millis();
-  while (millis() - now < delayms)
-    ProcessLEDs();
-}
-
+// the bench env links src/bench/bench.cpp in place of setup() and loop()
+#if !defined(BENCH)
 void setup()
 {
   Serial.begin(115200);
-  Serial.println("DEBUG: Board started");
-  Wire.begin();
+  LogInit();
+  //the host resends the spacestate when it sees this exact line
+  LogAlways("DEBUG: Board started");
+  EventPost(EVENT_BOOT);
+  StoreInit();
 
   stepper.begin(RPM);
   stepper.enable();
   stepper.setMicrostep(1);  // Set microstep mode to 1:1
 
-  pinMode(INPUT_SOLENOID, INPUT_PULLUP);
-  pinMode(INPUT_HORN, INPUT_PULLUP);
+  InputAdd(INPUTID_SOLENOID, INPUT_SOLENOID);
+  InputAdd(INPUTID_HORN, INPUT_HORN);
+  InputSetOutput(INPUTID_HORN, PIN_HORN);
   pinMode(PIN_LEDSOLENOID, OUTPUT);
   pinMode(PIN_LEDHORN, OUTPUT);
   pinMode(PIN_DOORPOWER, OUTPUT);
@@ -184,256 +150,123 @@ void setup()
   pinMode(PIN_OPEN, OUTPUT);
   pinMode(PIN_CLOSE, OUTPUT);
   pinMode(PIN_HORN, OUTPUT);  
-
-  pinMode(PIN_LEDGREEN, OUTPUT);
-  pinMode(PIN_LEDRED, OUTPUT);
-  pinMode(PIN_MAINS_POWER, INPUT);
+  pinMode(PIN_DOORDONE, INPUT_PULLUP);
 
   digitalWrite(PIN_OPEN, LOW);
   digitalWrite(PIN_CLOSE, LOW);
   digitalWrite(PIN_DOORPOWER, LOW);
-  digitalWrite(PIN_HORN, LOW);
   digitalWrite(PIN_SOLENOID, LOW);
 
+  digitalWrite(PIN_LEDSOLENOID, HIGH);
+  digitalWrite(PIN_LEDHORN, HIGH);
+
+  LEDInit();
   SetLEDState(LEDState_Off);
 
   Entropy.initialize();
+  LatencyInit();
+
+  TaskCreate(TASK_SERIAL, SerialTask, 1);
+  TaskCreate(TASK_READER, ReaderTask, READER_INTERVAL);
+  TaskCreate(TASK_LOCK, LockTask, 0);
+  TaskStop(TASK_LOCK);
+  TaskCreate(TASK_SOLENOID, SolenoidTask, 0);
+  TaskStop(TASK_SOLENOID);
+  TaskCreate(TASK_INPUTS, InputTask, 1);
+  TaskCreate(TASK_LOG, LogTask, 1);
+  TaskCreate(TASK_STEPPER, StepperTask, 0);
+  TaskStop(TASK_STEPPER);
+  TaskCreate(TASK_POWER, PowerTask, POWER_INTERVAL);
+  TaskCreate(TASK_STORE, StoreTask, 1);
+  TaskStop(TASK_STORE);
+
+  PowerInit();
+  ApplyPowerMode();
 }
-
-void writeEEPROM(unsigned int eeaddress, byte data )
-{
-  Wire.beginTransmission(EEPROMDEVICEADDRESS);
-  Wire.write((int)(eeaddress >> 8));   // MSB
-  Wire.write((int)(eeaddress & 0xFF)); // LSB
-  Wire.write(data);
-  Wire.endTransmission();
-
-  delay(5);
-}
-
-byte readEEPROM(unsigned int eeaddress )
-{
-  byte rdata = 0xFF;
-
-  Wire.beginTransmission(EEPROMDEVICEADDRESS);
-  Wire.write((int)(eeaddress >> 8));   // MSB
-  Wire.write((int)(eeaddress & 0xFF)); // LSB
-  Wire.endTransmission();
-
-  Wire.requestFrom(EEPROMDEVICEADDRESS,1);
-
-  if (Wire.available()) rdata = Wire.read();
-
-  return rdata;
-}
-
-void AddButton(uint8_t* addr, uint8_t* secret)
-{
-  for (uint16_t i = 0; i < EEPROMSIZE / STORAGESIZE; i++)
-  {
-    bool emptyslot = true;
-    uint16_t startaddr = i * STORAGESIZE;
-    for (uint16_t j = 0; j < ADDRSIZE; j++)
-    {
-      uint8_t eeprombyte = readEEPROM(startaddr + j);
-      if (eeprombyte != 0xFF && eeprombyte != addr[j])
-      {
-        emptyslot = false;
-        break;
-      }
-    }
-
-    if (emptyslot)
-    {
-      for (uint16_t j = 0; j < ADDRSIZE; j++)
-        writeEEPROM(startaddr + j, addr[j]);
-
-      for (uint16_t j = 0; j < SECRETSIZE; j++)
-        writeEEPROM(startaddr + j + ADDRSIZE, secret[j]);
-
-      Serialprintf("DEBUG: stored button in slot %i\n", i);
-
-      return;
-    }
-  }
-
-  Serial.println("ERROR: no room in eeprom to store button");
-}
-
-void RemoveButton(uint8_t* addr)
-{
-  for (uint16_t i = 0; i < EEPROMSIZE / STORAGESIZE; i++)
-  {
-    uint16_t startaddr = i * STORAGESIZE;
-    bool sameaddr = true;
-    for (uint16_t j = 0; j < ADDRSIZE; j++)
-    {
-      uint8_t eeprombyte = readEEPROM(startaddr + j);
-      if (eeprombyte != addr[j])
-      {
-        sameaddr = false;
-        break;
-      }
-    }
-    if (!sameaddr)
-      continue;
-
-    Serialprintf("DEBUG: erasing slot %i\n", i);
-
-    for (uint16_t j = 0; j < STORAGESIZE; j++)
-      writeEEPROM(startaddr + j, 0xFF);
-  }
-}
-
-bool GetButtonSecret(uint8_t* addr, uint8_t* secret)
-{
-  for (uint16_t i = 0; i < EEPROMSIZE / STORAGESIZE; i++)
-  {
-    uint16_t startaddr = i * STORAGESIZE;
-    bool sameaddr = true;
-    bool isempty = true;
-    for (uint16_t j = 0; j < ADDRSIZE; j++)
-    {
-      uint8_t eeprombyte = readEEPROM(startaddr + j);
-      if (isempty && eeprombyte != 0xFF)
-        isempty = false;
-
-      if (eeprombyte != addr[j])
-      {
-        sameaddr = false;
-        break;
-      }
-    }
-
-    if (isempty)
-      continue;
-
-    if (sameaddr)
-    {
-      Serialprintf("DEBUG: getting secret from slot %i\n", i);
-
-      for (uint16_t j = 0; j < SECRETSIZE; j++)
-        secret[j] = readEEPROM(startaddr + j + ADDRSIZE);
-
-      return true;
-    }
-  }
-
-  Serial.println("DEBUG: can't find secret for button");
-
-  return false;
-}
-
-void ListButtons()
-{
-  Serial.println("button list start");
-
-  for (uint16_t i = 0; i < EEPROMSIZE / STORAGESIZE; i++)
-  {
-    uint16_t startaddr = i * STORAGESIZE;
-    uint8_t  buttonid[ADDRSIZE];
-    bool     isempty = true;
-    for (uint16_t j = 0; j < ADDRSIZE; j++)
-    {
-      uint8_t eeprombyte = readEEPROM(startaddr + j);
-      if (isempty && eeprombyte != 0xFF)
-        isempty = false;
-
-      buttonid[j] = eeprombyte;
-    }
-
-    if (isempty)
-      continue;
-
-    Serialprintf("button: ");
-    for (uint16_t j = 0; j < ADDRSIZE; j++)
-      Serialprintf("%02x", buttonid[j]);
-    Serialprintf("\n");
-  }
-}
+#endif
 
 #define RANDOMDELAY_MIN  50
 #define RANDOMDELAY_MAX 200
 
-bool AuthenticateButton(uint8_t* addr)
+bool AuthenticateButton(DS1961* ibutton, uint8_t* addr)
 {
+  uint32_t start = TraceStart();
   uint8_t secret[SECRETSIZE];
-  if (!GetButtonSecret(addr, secret))
+  bool found = StoreGetSecret(addr, secret);
+  TraceEnd(TRACE_LOOKUP, start);
+  if (!found)
     return false;
 
   uint8_t mac_from_ibutton[SHA1SIZE];
   uint8_t data[32];
   uint8_t nonce[3];
 
+  //the nonce and the random delay take the 4 bytes of one word of the pool,
+  //ReaderTask only scans when there is one, so this doesn't wait
+  start = TraceStart();
   for (uint8_t i = 0; i < sizeof(nonce); i++)
     nonce[i] = Entropy.randomByte();
+  uint8_t delaybyte = Entropy.randomByte();
+  TraceEnd(TRACE_NONCE, start);
 
-  if (!ibutton.ReadAuthWithChallenge(addr, 0, nonce, data, mac_from_ibutton))
+  start = TraceStart();
+  bool readok = ibutton->ReadAuthWithChallenge(addr, 0, nonce, data, mac_from_ibutton);
+  TraceEnd(TRACE_CHALLENGE, start);
+  if (!readok)
+  {
+    //keep the transcript of the retries for the capture command
+    CaptureHold();
     return false;
+  }
 
-  sha1::sha1nfo sha1data = {};
-  sha1::sha1_init(&sha1data);
-  sha1::sha1_write(&sha1data, (const char*)secret, 4);
-  sha1::sha1_write(&sha1data, (const char*)data, sizeof(data));
-  sha1::sha1_writebyte(&sha1data, 0xff);
-  sha1::sha1_writebyte(&sha1data, 0xff);
-  sha1::sha1_writebyte(&sha1data, 0xff);
-  sha1::sha1_writebyte(&sha1data, 0xff);
-  sha1::sha1_writebyte(&sha1data, 0x40);
-  sha1::sha1_write(&sha1data, (const char*)addr, ADDRSIZE - 1);
-  sha1::sha1_write(&sha1data, (const char*)secret + 4, 4);
-  sha1::sha1_write(&sha1data, (const char*)nonce, sizeof(nonce));
-
-  uint8_t* sha_computed = sha1::sha1_result(&sha1data);
-
+  start = TraceStart();
   uint8_t mac_computed[SHA1SIZE];
-  ((uint32_t*)mac_computed)[0] = htonl(ntohl(*(uint32_t *)sha_computed) - 0x67452301);
-  ((uint32_t*)mac_computed)[1] = htonl(ntohl(*(uint32_t *)(sha_computed+4)) - 0xefcdab89);
-  ((uint32_t*)mac_computed)[2] = htonl(ntohl(*(uint32_t *)(sha_computed+8)) - 0x98badcfe);
-  ((uint32_t*)mac_computed)[3] = htonl(ntohl(*(uint32_t *)(sha_computed+12)) - 0x10325476);
-  ((uint32_t*)mac_computed)[4] = htonl(ntohl(*(uint32_t *)(sha_computed+16)) - 0xc3d2e1f0);
+  DS1961::ComputeMAC(addr, secret, data, nonce, mac_computed);
 
   //this check should always take the same amount of time, to prevent a timing attack
   bool macvalid = true;
   for (uint8_t i = 0; i < SHA1SIZE; i++)
   {
-    if (mac_from_ibutton[i] != mac_computed[SHA1SIZE - 1 - i])
+    if (mac_from_ibutton[i] != mac_computed[i])
       macvalid = false;
   }
+  TraceEnd(TRACE_MAC, start);
 
   //add a random delay
-  delayMicroseconds(Entropy.random(RANDOMDELAY_MIN, RANDOMDELAY_MAX));
+  start = TraceStart();
+  delayMicroseconds(RANDOMDELAY_MIN + (uint16_t)delaybyte * (RANDOMDELAY_MAX - RANDOMDELAY_MIN) / 255);
+  TraceEnd(TRACE_RANDOMDELAY, start);
 
   return macvalid;
 }
 
-bool ReadCMD(char* cmdbuf, uint8_t* cmdbuffill)
+// one line per 1-Wire reader and one for the EEPROM, a reader with a dirty pad
+// shows up here as presence, crc and status errors long before it fails
+void BusPrint()
 {
-  uint32_t cmdstarttime = millis();
-  *cmdbuffill = 0;
-  for(;;)
+  for (uint8_t i = 0; i < READER_COUNT; i++)
   {
-    if (Serial.available())
-    {
-      char input = Serial.read();
-      if (input == '\n')
-      {
-        cmdbuf[*cmdbuffill] = 0;
-        return true;
-      }
-      else if (*cmdbuffill < CMD_BUFSIZE - 1)
-      {
-        cmdbuf[*cmdbuffill] = input;
-        (*cmdbuffill)++;
-      }
-    }
-
-    if (millis() - cmdstarttime >= CMD_TIMEOUT)
-    {
-      Serial.println("ERROR: timeout receiving command");
-      return false;
-    }
+    ds1961stats stats;
+    g_readers[i].ibutton->GetStats(&stats);
+    LogAlways("bus reader %u presence %u crc %u status %u retries %u failures %u", i,
+              stats.presence, stats.crc, stats.status, stats.retries, stats.failures);
   }
+
+  twistats   twi;
+  storestats store;
+  TwiGetStats(&twi);
+  StoreGetStats(&store);
+  LogAlways("bus eeprom nack %u timeout %u polls %u retries %u failures %u", twi.nack,
+            twi.timeout, twi.polls, store.retries, store.failures);
+}
+
+void BusReset()
+{
+  for (uint8_t i = 0; i < READER_COUNT; i++)
+    g_readers[i].ibutton->ResetStats();
+
+  TwiResetStats();
+  StoreResetStats();
 }
 
 uint8_t NextWordPos(char* cmdbuf, uint8_t cmdbuffill, uint8_t index)
@@ -458,18 +291,18 @@ uint8_t NextWordPos(char* cmdbuf, uint8_t cmdbuffill, uint8_t index)
   return 0;
 }
 
-bool GetHexWordFromCMD(char* cmdbuf, uint8_t cmdbuffill, uint8_t* wordpos, uint8_t* wordbuf, uint8_t wordsize, char* wordname)
+bool GetHexWordFromCMD(char* cmdbuf, uint8_t cmdbuffill, uint8_t* wordpos, uint8_t* wordbuf, uint8_t wordsize, const char* wordname)
 {
   *wordpos = NextWordPos(cmdbuf, cmdbuffill, *wordpos);
 
   if (*wordpos == 0)
   {
-    Serialprintf("ERROR: no %s found in command\n", wordname);
+    LogError("no %s found in command", wordname);
     return false;
   }
   else if (cmdbuffill - *wordpos < wordsize * 2)
   {
-    Serialprintf("ERROR: %s is too short\n", wordname);
+    LogError("%s is too short", wordname);
     return false;
   }
 
@@ -477,14 +310,14 @@ bool GetHexWordFromCMD(char* cmdbuf, uint8_t cmdbuffill, uint8_t* wordpos, uint8
   {
     if ((cmdbuf[*wordpos + i * 2] == ' ') || (cmdbuf[*wordpos + i * 2 + 1] == ' '))
     {
-      Serialprintf("ERROR: %s is too short\n", wordname);
+      LogError("%s is too short", wordname);
       return false;
     }
 
     int numread = sscanf(cmdbuf + *wordpos + i * 2, "%2hhx", wordbuf + i);
     if (numread != 1)
     {
-      Serialprintf("ERROR: %s is invalid\n", wordname);
+      LogError("%s is invalid", wordname);
       return false;
     }
   }
@@ -495,15 +328,26 @@ bool GetHexWordFromCMD(char* cmdbuf, uint8_t cmdbuffill, uint8_t* wordpos, uint8
 #define CMD_ADD_BUTTON    "add_button"
 #define CMD_REMOVE_BUTTON "remove_button"
 #define CMD_LIST_BUTTONS "list_buttons"
+#define CMD_LOGLEVEL      "loglevel"
+#define CMD_REPLAY_SINCE  "replay_since"
+#define CMD_SPACESTATE    "spacestate"
+#define CMD_STATS         "stats"
+#define CMD_MEM           "mem"
+#define CMD_CAPTURE       "capture"
 
 void ParseCMD(char* cmdbuf, uint8_t cmdbuffill)
 {
-  Serial.print("DEBUG: Received cmd: ");
-  Serial.println(cmdbuf);
+  LogDebug("Received cmd: %s", cmdbuf);
 
   bool isadd = strncmp(CMD_ADD_BUTTON, cmdbuf, strlen(CMD_ADD_BUTTON)) == 0;
   bool isremove = strncmp(CMD_REMOVE_BUTTON, cmdbuf, strlen(CMD_REMOVE_BUTTON)) == 0;
   bool islist = strncmp(CMD_LIST_BUTTONS, cmdbuf, strlen(CMD_LIST_BUTTONS)) == 0;
+  bool isloglevel = strncmp(CMD_LOGLEVEL, cmdbuf, strlen(CMD_LOGLEVEL)) == 0;
+  bool isreplay = strncmp(CMD_REPLAY_SINCE, cmdbuf, strlen(CMD_REPLAY_SINCE)) == 0;
+  bool isspacestate = strncmp(CMD_SPACESTATE, cmdbuf, strlen(CMD_SPACESTATE)) == 0;
+  bool isstats = strncmp(CMD_STATS, cmdbuf, strlen(CMD_STATS)) == 0;
+  bool ismem = strncmp(CMD_MEM, cmdbuf, strlen(CMD_MEM)) == 0;
+  bool iscapture = strncmp(CMD_CAPTURE, cmdbuf, strlen(CMD_CAPTURE)) == 0;
 
   if (isadd || isremove)
   {
@@ -512,10 +356,8 @@ void ParseCMD(char* cmdbuf, uint8_t cmdbuffill)
     if (!GetHexWordFromCMD(cmdbuf, cmdbuffill, &wordpos, addr, ADDRSIZE, "address"))
       return;
 
-    Serial.print("DEBUG: Received address ");
-    for (uint8_t i = 0; i < ADDRSIZE; i++)
-      Serialprintf("%02x", addr[i]);
-    Serial.print("\n");
+    char hex[ADDRSIZE * 2 + 1];
+    LogDebug("Received address %s", FormatHex(hex, addr, ADDRSIZE));
 
     bool addrvalid = false;
     for (uint8_t i = 0; i < ADDRSIZE; i++)
@@ -528,7 +370,7 @@ void ParseCMD(char* cmdbuf, uint8_t cmdbuffill)
     }
     if (!addrvalid)
     {
-      Serial.println("ERROR: address FFFFFFFFFFFFFFFF is invalid");
+      LogError("address FFFFFFFFFFFFFFFF is invalid");
       return;
     }
 
@@ -538,163 +380,474 @@ void ParseCMD(char* cmdbuf, uint8_t cmdbuffill)
       if (!GetHexWordFromCMD(cmdbuf, cmdbuffill, &wordpos, secret, SECRETSIZE, "secret"))
         return;
 
-      Serial.print("DEBUG: Received secret ");
-      for (uint8_t i = 0; i < ADDRSIZE; i++)
-        Serialprintf("%02x", secret[i]);
-      Serial.print("\n");
+      LogDebug("Received secret %s", FormatHex(hex, secret, SECRETSIZE));
 
-      AddButton(addr, secret);
+      StoreAdd(addr, secret);
     }
     else
     {
-      Serialprintf("DEBUG: removing button\n");
-      RemoveButton(addr);
+      LogDebug("removing button");
+      StoreRemove(addr);
     }
+
+    TaskWakeIn(TASK_STORE, 0);
   }
   else if (islist)
   {
-    ListButtons();
+    StoreList();
+  }
+  else if (isloglevel)
+  {
+    uint8_t wordpos = NextWordPos(cmdbuf, cmdbuffill, 0);
+    if (wordpos != 0)
+    {
+      char* level = cmdbuf + wordpos;
+      if (strncmp_P(level, PSTR("error"), 5) == 0)
+        LogSetLevel(LOGLEVEL_ERROR);
+      else if (strncmp_P(level, PSTR("info"), 4) == 0)
+        LogSetLevel(LOGLEVEL_INFO);
+      else if (strncmp_P(level, PSTR("debug"), 5) == 0)
+        LogSetLevel(LOGLEVEL_DEBUG);
+      else if (*level >= '0' && *level <= '9')
+        LogSetLevel(*level - '0');
+      else
+        LogError("unknown log level %s", level);
+    }
+
+    LogAlways("loglevel: %u", LogGetLevel());
+  }
+  else if (isreplay)
+  {
+    uint8_t wordpos = NextWordPos(cmdbuf, cmdbuffill, 0);
+    if (wordpos == 0)
+    {
+      LogError("no sequence number found in command");
+      return;
+    }
+
+    EventReplaySince(strtoul(cmdbuf + wordpos, NULL, 10));
+  }
+  else if (isspacestate)
+  {
+    uint8_t wordpos = NextWordPos(cmdbuf, cmdbuffill, 0);
+    if (wordpos != 0)
+    {
+      char* state = cmdbuf + wordpos;
+      if (strncmp_P(state, PSTR("open"), 4) == 0)
+        g_spacestate = true;
+      else if (strncmp_P(state, PSTR("closed"), 6) == 0)
+        g_spacestate = false;
+      else
+        LogError("unknown spacestate %s", state);
+    }
+
+    LogAlways("spacestate: %s", g_spacestate ? "open" : "closed");
+  }
+  else if (isstats)
+  {
+    uint8_t wordpos = NextWordPos(cmdbuf, cmdbuffill, 0);
+    if (wordpos != 0 && strncmp_P(cmdbuf + wordpos, PSTR("reset"), 5) == 0)
+    {
+      TraceReset();
+      LatencyReset();
+      BusReset();
+      LogAlways("stats reset");
+    }
+    else
+    {
+      TracePrint();
+      LatencyPrint();
+      BusPrint();
+    }
+  }
+  else if (ismem)
+  {
+    LogAlways("mem static %u heap %u free %u minfree %u", MemStatic(), MemHeap(), MemFree(), MemMinFree());
+  }
+  else if (iscapture)
+  {
+    uint8_t wordpos = NextWordPos(cmdbuf, cmdbuffill, 0);
+    if (wordpos != 0 && strncmp_P(cmdbuf + wordpos, PSTR("reset"), 5) == 0)
+      CaptureClear();
+    else
+      CapturePrint();
   }
   else
   {
-    Serial.println("Unknown command");
+    LogAlways("Unknown command");
   }
 }
 
 #define TOGGLE_TIME 2500
-#define BUTTON_TIME 250
+#define SETTLE_TIME 4000  // door power stays on this long after the toggle
+#define SOLENOID_TIME 5000
+#define DOORDONE_INTERVAL 10 // ms between polls of the done line
+
+bool     g_lockbusy = false;
+uint32_t g_lockstarttime;
+bool     g_doorstarted;
 
-void ToggleLock()
+void StartLockToggle()
 {
+  g_lockbusy = true;
+  g_lockstarttime = millis();
+  g_doorstarted = false;
+  SetLEDState(LEDState_Authorized);
+
   if (g_lockopen)
   {
     g_lockopen = false;
-    Serial.println("closing lock");
+    LEDSetLockOpen(g_lockopen);
+    EventPost(EVENT_LOCK_CLOSING);
     digitalWrite(PIN_DOORPOWER, HIGH);
     digitalWrite(PIN_CLOSE, HIGH);
-    DelayLEDs(BUTTON_TIME);
-    DelayLEDs(TOGGLE_TIME - BUTTON_TIME);
   }
   else
   {
     g_lockopen = true;
-    Serial.println("opening lock");
+    LEDSetLockOpen(g_lockopen);
+    EventPost(EVENT_LOCK_OPENING);
     digitalWrite(PIN_DOORPOWER, HIGH);
     digitalWrite(PIN_OPEN, HIGH);
-    DelayLEDs(BUTTON_TIME);
-    DelayLEDs(TOGGLE_TIME - BUTTON_TIME);
   }
 
-  DelayLEDs(4000);
+  TaskWakeIn(TASK_LOCK, DOORDONE_INTERVAL);
+}
+
+void ActivateSolenoid(uint8_t source)
+{
+  StateSolenoid = true;
+  SolenoidStartTime = millis();
+  EventPost(EVENT_SOLENOID_ON, source);
+  digitalWrite(PIN_SOLENOID, HIGH);
+  stepper.enable();
+  stepper.startMove(MOTOR_STEPS*(RPM/60)*10);
+
+  TaskWakeIn(TASK_SOLENOID, SOLENOID_TIME);
+  TaskWakeIn(TASK_STEPPER, 0);
+}
+
+// Waits for the door controller to report that it reached its stopper or
+// stalled, then drops door power. While the door controller is still
+// unpowered its pin can read low through its protection diodes, so done only
+// counts after the line has been seen high once. Without a door controller
+// that reports back, the lock falls back to the old fixed time.
+void LockTask()
+{
+  uint32_t elapsed = millis() - g_lockstarttime;
+  bool doordone = digitalRead(PIN_DOORDONE) == LOW;
+  if (!doordone)
+    g_doorstarted = true;
+
+  if (g_doorstarted && doordone)
+  {
+    LogDebug("door reported done after %lu ms", (unsigned long)elapsed);
+  }
+  else if (elapsed >= TOGGLE_TIME + SETTLE_TIME)
+  {
+    LogDebug("door didn't report done, timed out");
+  }
+  else
+  {
+    TaskWakeIn(TASK_LOCK, DOORDONE_INTERVAL);
+    return;
+  }
+
   digitalWrite(PIN_OPEN, LOW);
   digitalWrite(PIN_CLOSE, LOW);
   digitalWrite(PIN_DOORPOWER, LOW);
+  g_lockbusy = false;
 
-  Serial.println("finished lock action");
+  EventPost(EVENT_LOCK_DONE, g_lockopen);
+
+  if (g_lockopen)
+    ActivateSolenoid(EVENT_SOURCE_IBUTTON);
 }
 
-bool HasMainsPower()
+// nextAction() busy-waits until the next step is due and then returns how many
+// microseconds are left until the one after it, so wake up just before then.
+void StepperTask()
 {
-  return digitalRead(PIN_MAINS_POWER) == HIGH;
+  uint32_t wait_time = stepper.nextAction();
+
+  // 0 wait time indicates the motor has stopped
+  if (wait_time > 0)
+    TaskWakeIn(TASK_STEPPER, wait_time / 1000);
+  else if (PowerOnBattery())
+    stepper.disable();
 }
 
-void loop()
+void SolenoidTask()
 {
-  uint8_t addr[ADDRSIZE];
-  uint32_t deniedcount = 0;
+  digitalWrite(PIN_SOLENOID, LOW);
+  StateSolenoid = false;
+  EventPost(EVENT_SOLENOID_OFF);
+}
+
+// On battery the reader is polled less often, with the 1-Wire pin change
+// interrupt waking the loop for a scan as soon as something touches it. The
+// stepper driver is only enabled while it moves, door power is already only
+// on during a lock action.
+void ApplyPowerMode()
+{
+  bool onbattery = PowerOnBattery();
+
+  TaskSetPeriod(TASK_READER, onbattery ? READER_INTERVAL_BATTERY : READER_INTERVAL);
+  LEDSetDimmed(onbattery);
+  for (uint8_t i = 0; i < READER_COUNT; i++)
+    InputWakeEnable(g_readers[i].pin, onbattery);
+
+  if (!onbattery)
+    stepper.enable();
+  else if (!TaskActive(TASK_STEPPER))
+    stepper.disable();
+}
+
+void PowerTask()
+{
+  if (!PowerUpdate())
+    return;
+
+  ApplyPowerMode();
+
+  if (PowerOnBattery())
+  {
+    EventPost(EVENT_MAINS_LOST);
+  }
+  else
+  {
+    EventPost(EVENT_MAINS_RESTORED);
+  }
+}
+
+char     g_cmdbuf[CMD_BUFSIZE];
+uint8_t  g_cmdbuffill;
+bool     g_cmdreceiving = false;
+uint32_t g_cmdstarttime;
 
-  for(;;)
+// A bare newline starts a command, the line after it is the command itself.
+void SerialTask()
+{
+  while (Serial.available())
   {
-    if (Serial.available())
+    char input = Serial.read();
+    if (!g_cmdreceiving)
     {
-      uint8_t input = Serial.read();
       if (input == '\n')
       {
         SetLEDState(LEDState_Busy);
-        Serial.println("ready");
+        LogAlways("ready");
+        g_cmdreceiving = true;
+        g_cmdbuffill = 0;
+        g_cmdstarttime = millis();
+      }
+    }
+    else if (input == '\n')
+    {
+      g_cmdbuf[g_cmdbuffill] = 0;
+      g_cmdreceiving = false;
+      ParseCMD(g_cmdbuf, g_cmdbuffill);
+      return;
+    }
+    else if (g_cmdbuffill < CMD_BUFSIZE - 1)
+    {
+      g_cmdbuf[g_cmdbuffill] = input;
+      g_cmdbuffill++;
+    }
+  }
+
+  if (g_cmdreceiving && millis() - g_cmdstarttime >= CMD_TIMEOUT)
+  {
+    LogError("timeout receiving command");
+    g_cmdreceiving = false;
+  }
+}
 
-        char    cmdbuf[CMD_BUFSIZE] = {};
-        uint8_t cmdbuffill;
-        if (ReadCMD(cmdbuf, &cmdbuffill))
-          ParseCMD(cmdbuf, cmdbuffill);
+uint8_t g_nextreader;
+bool    g_readerwake;
+
+void ReadReader(uint8_t index)
+{
+  reader* rd = &g_readers[index];
+
+  if ((rd->policy & READER_SPACEOPEN) && !g_spacestate)
+  {
+    rd->deniedcount = 0;
+    return;
+  }
+
+  //a button held against a solenoid reader must not keep firing it either
+  if (!(rd->policy & READER_TOGGLE) && StateSolenoid)
+    return;
+
+  uint8_t addr[ADDRSIZE];
+  uint32_t start = TraceStart();
+  rd->bus->reset_search();
+  if (rd->bus->search(addr) && OneWire::crc8(addr, 7) == addr[7])
+  {
+    TraceEnd(TRACE_SEARCH, start);
+
+    char hex[ADDRSIZE * 2 + 1];
+    LogDebug("Found iButton with address: %s on reader %u", FormatHex(hex, addr, ADDRSIZE), index);
+    LogProcess();
+
+    start = TraceStart();
+    bool authenticated = AuthenticateButton(rd->ibutton, addr);
+    TraceEnd(TRACE_AUTH, start);
+
+    if (authenticated)
+    {
+      EventPost(EVENT_AUTH_OK, index);
+      if (rd->policy & READER_TOGGLE)
+        StartLockToggle();
+      else
+        ActivateSolenoid(EVENT_SOURCE_IBUTTON);
+      rd->deniedcount = 0;
+    }
+    else
+    {
+      rd->deniedcount++;
+      EventPost(EVENT_AUTH_DENIED, rd->deniedcount);
+      if (rd->deniedcount == EVENT_DENIED_LIMIT)
+      {
+        SetLEDState(LEDState_Busy);
+        //disabled because sounding the horn resets the arduino
+        //digitalWrite(PIN_HORN, HIGH);
+        //digitalWrite(PIN_HORN, LOW);
+        rd->deniedcount = 0;
       }
     }
+  }
+  else
+  {
+    rd->deniedcount = 0;
+  }
+}
 
+// Scans one reader per run, round robin, so one loop pass never waits for
+// more than one search. After a wake on battery it's not known which reader
+// was touched, so all of them are scanned.
+void ReaderTask()
+{
+  //a button held against the reader must not toggle the lock again
+  if (g_lockbusy)
+    return;
+
+  if (!g_cmdreceiving)
     SetLEDState(LEDState_Reading);
 
-    ds.reset_search();
-    if (ds.search(addr) && OneWire::crc8(addr, 7) == addr[7])
-    {
-      Serial.print("DEBUG: Found iButton with address: ");
-      for (uint8_t i = 0; i < sizeof(addr); i++)
-        Serialprintf("%02x", addr[i]);
-      Serial.print('\n');
+  //nor on the entropy pool, a touch is seen again on the next run
+  if (!Entropy.available())
+    return;
 
-      if (AuthenticateButton(addr))
-      {
-        SetLEDState(LEDState_Authorized);
-        Serial.print("iButton authenticated\n");
-        ToggleLock();
-        deniedcount = 0;
-
-        if(g_lockopen == true){
-          StateSolenoid = true;
-          SolenoidStartTime = millis();
-          Serial.print("Solenoid activated\n");
-          digitalWrite(PIN_SOLENOID, HIGH);
-          stepper.move(MOTOR_STEPS*(RPM/60)*10);
-        }
+  //nothing on the way from touch to unlock may wait on the UART
+  LogSetBlocking(false);
+
+  //the search itself toggles the pins
+  bool onbattery = PowerOnBattery();
+  if (onbattery)
+  {
+    for (uint8_t i = 0; i < READER_COUNT; i++)
+      InputWakeEnable(g_readers[i].pin, false);
+  }
+
+  if (g_readerwake)
+  {
+    g_readerwake = false;
+    for (uint8_t i = 0; i < READER_COUNT && !g_lockbusy; i++)
+      ReadReader(i);
+  }
+  else
+  {
+    ReadReader(g_nextreader);
+    g_nextreader = (g_nextreader + 1) % READER_COUNT;
+  }
 
+  if (onbattery)
+  {
+    InputTakeWake();
+    for (uint8_t i = 0; i < READER_COUNT; i++)
+      InputWakeEnable(g_readers[i].pin, true);
+  }
+
+  LogSetBlocking(true);
+}
+
+void InputTask()
+{
+  InputProcess();
+
+  inputevent ev;
+  while (InputNextEvent(&ev))
+  {
+    if (ev.id == INPUTID_HORN)
+    {
+      //the interrupt already drove the horn, this only reports it with the
+      //time of the edge, the loop may have been busy since
+      if (ev.pressed)
+      {
+        StateHorn = true;
+        EventPostAt(EVENT_HORN_ON, ev.time);
       }
       else
       {
-        deniedcount++;
-        if (deniedcount == 3)
-        {
-          Serial.print("iButton not authenticated\n");
-          SetLEDState(LEDState_Busy);
-          //disabled because sounding the horn resets the arduino
-          //digitalWrite(PIN_HORN, HIGH);
-          //DelayLEDs(500);
-          //digitalWrite(PIN_HORN, LOW);
-          deniedcount = 0;
-        }
+        StateHorn = false;
+        LogInfo("Horn released after %u ms", ev.duration);
+        EventPostAt(EVENT_HORN_OFF, ev.time, ev.duration);
       }
     }
-    else
+    else if (ev.id == INPUTID_SOLENOID)
     {
-      deniedcount = 0;
+      if (ev.pressed)
+        EventPostAt(EVENT_OPENBUTTON_PRESSED, ev.time);
+      else
+        EventPostAt(EVENT_OPENBUTTON_RELEASED, ev.time, ev.duration);
     }
+  }
 
-    ProcessLEDs();
-
-    digitalWrite(PIN_LEDSOLENOID, HIGH);
-    digitalWrite(PIN_LEDHORN, HIGH);
-    if (digitalRead(INPUT_SOLENOID) == LOW) {
-      if(StateSolenoid == false){
-        StateSolenoid = true;
-        SolenoidStartTime = millis();
-        Serial.print("Solenoid activated\n");
-        digitalWrite(PIN_SOLENOID, HIGH);
-        stepper.move(MOTOR_STEPS*(RPM/60)*10);
-      }
-    }
-    if(StateSolenoid == true && ((millis() - SolenoidStartTime) > (5*1000)) ){
-      digitalWrite(PIN_SOLENOID, LOW);
-      StateSolenoid = false;
-    }
-    if (digitalRead(INPUT_HORN) == LOW) {
-      if(StateHorn == false){
-        StateHorn = true;
-        Serial.print("Horn activated\n");
-        digitalWrite(PIN_HORN, HIGH);
-      }
-    }else{
-      StateHorn = false;
-      digitalWrite(PIN_HORN, LOW);
-    }
+  //holding the button keeps the solenoid going after it times out
+  if (InputPressed(INPUTID_SOLENOID) && !StateSolenoid)
+    ActivateSolenoid(EVENT_SOURCE_INPUT);
+}
 
+// runs every ms while buttons are being added or removed
+void StoreTask()
+{
+  StoreProcess();
+  if (!StoreBusy())
+    TaskStop(TASK_STORE);
+}
 
-  }
+void LogTask()
+{
+  EventProcess();
+  LogProcess();
 }
 
+#if !defined(BENCH)
+bool g_memcanaryhit = false;
+
+void loop()
+{
+  LatencyLoop();
+  TaskRunDue();
+
+  if (!g_memcanaryhit && !MemCheck())
+  {
+    g_memcanaryhit = true;
+    LogError("stack overwrote the memory canary");
+  }
+
+  noInterrupts();
+  if (!TaskAnyDue() && !InputWakePending())
+    PowerIdle();
+  interrupts();
+
+  //something touched the reader, or a button or serial byte woke us up
+  if (InputTakeWake() && PowerOnBattery())
+  {
+    g_readerwake = true;
+    TaskWakeIn(TASK_READER, 0);
+  }
+}
+#endif
@@ -0,0 +1,81 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <Arduino.h>
+
+#include "mem.h"
+
+#if defined(__AVR__)
+extern uint8_t __heap_start;
+extern uint8_t __stack;
+extern char*   __brkval;
+
+// Runs from .init3, after the stack pointer and the zero register are set up
+// and before the statics are initialized or main() is called, so nothing is
+// on the stack yet that could be painted over.
+void MemPaint() __attribute__((naked, used, section(".init3")));
+void MemPaint()
+{
+  for (uint8_t* p = &__heap_start; p <= &__stack; p++)
+    *p = MEM_PAINT;
+}
+
+static uint8_t* HeapTop()
+{
+  return __brkval ? (uint8_t*)__brkval : &__heap_start;
+}
+#endif
+
+uint16_t MemStatic()
+{
+#if defined(__AVR__)
+  return (uint16_t)&__heap_start - RAMSTART;
+#else
+  return 0;
+#endif
+}
+
+uint16_t MemHeap()
+{
+#if defined(__AVR__)
+  return HeapTop() - &__heap_start;
+#else
+  return 0;
+#endif
+}
+
+uint16_t MemFree()
+{
+#if defined(__AVR__)
+  return SP - (uint16_t)HeapTop();
+#else
+  return 0;
+#endif
+}
+
+uint16_t MemMinFree()
+{
+#if defined(__AVR__)
+  const uint8_t* p = HeapTop();
+  while (p <= &__stack && *p == MEM_PAINT)
+    p++;
+
+  return p - HeapTop();
+#else
+  return 0;
+#endif
+}
+
+bool MemCheck()
+{
+#if defined(__AVR__) && defined(MEM_CANARY)
+  const uint8_t* p = HeapTop();
+  for (uint8_t i = 0; i < MEM_CANARYSIZE; i++)
+  {
+    if (p[i] != MEM_PAINT)
+      return false;
+  }
+#endif
+
+  return true;
+}
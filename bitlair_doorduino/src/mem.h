@@ -0,0 +1,34 @@
+#ifndef _MEM_H_
+#define _MEM_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// SRAM usage. At boot, before anything runs, the free RAM between the heap
+// and the stack is painted with MEM_PAINT. The stack overwrites the paint as
+// it grows, so the untouched bytes above the heap are the least free RAM there
+// has been since boot.
+//
+// With MEM_CANARY defined, MemCheck() looks at the lowest MEM_CANARYSIZE
+// painted bytes, which the stack only reaches right before it runs into the
+// heap and the statics.
+
+#define MEM_PAINT              0xC5
+#define MEM_CANARYSIZE         4
+
+// bytes used by .data and .bss
+uint16_t MemStatic();
+
+// bytes used by the heap
+uint16_t MemHeap();
+
+// bytes between the top of the heap and the stack pointer right now
+uint16_t MemFree();
+
+// the least free bytes since boot
+uint16_t MemMinFree();
+
+// returns false once the stack reached the canary, call this from loop()
+bool MemCheck();
+
+#endif /* _MEM_H_ */
@@ -0,0 +1,59 @@
+#ifndef _A4988_H_
+#define _A4988_H_
+
+#include "Arduino.h"
+
+// Stands in for the A4988 driver of the StepperDriver library in the host
+// build. It pulses the step pin and paces the steps at the set speed, without
+// acceleration.
+class A4988
+{
+public:
+  A4988(short steps, short dir_pin, short step_pin)
+    : motor_steps(steps), dir_pin(dir_pin), step_pin(step_pin), rpm(60), remaining(0), enabled(false)
+  {
+  }
+
+  void begin(float rpm = 60, short /* microsteps */ = 1)
+  {
+    this->rpm = rpm;
+    pinMode(dir_pin, OUTPUT);
+    pinMode(step_pin, OUTPUT);
+  }
+
+  void enable()                 { enabled = true; }
+  void disable()                { enabled = false; }
+  void setMicrostep(short)      { }
+  bool isEnabled()              { return enabled; }
+
+  void startMove(long steps)
+  {
+    digitalWrite(dir_pin, steps >= 0 ? HIGH : LOW);
+    remaining = steps >= 0 ? steps : -steps;
+  }
+
+  void stop()                   { remaining = 0; }
+
+  // gives one step and returns the us until the next, 0 once the move is done
+  long nextAction()
+  {
+    if (remaining == 0)
+      return 0;
+
+    digitalWrite(step_pin, HIGH);
+    digitalWrite(step_pin, LOW);
+    remaining--;
+
+    return 60000000L / (long)(rpm * motor_steps);
+  }
+
+private:
+  short motor_steps;
+  short dir_pin;
+  short step_pin;
+  float rpm;
+  long  remaining;
+  bool  enabled;
+};
+
+#endif /* _A4988_H_ */
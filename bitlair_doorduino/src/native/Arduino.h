@@ -0,0 +1,89 @@
+#ifndef Arduino_h
+#define Arduino_h
+
+// The part of the Arduino API the lock uses, for the host build. The pins,
+// the serial port and the clock behind it are simulated in sim.cpp.
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HIGH                   1
+#define LOW                    0
+
+#define INPUT                  0
+#define OUTPUT                 1
+#define INPUT_PULLUP           2
+
+// pin numbers of the Nano
+#define A0                     14
+#define A1                     15
+#define A2                     16
+#define A3                     17
+#define A4                     18
+#define A5                     19
+#define A6                     20
+#define A7                     21
+#define SDA                    A4
+#define SCL                    A5
+#define NOT_A_PIN              0
+
+#define DEC                    10
+#define HEX                    16
+
+typedef uint8_t byte;
+typedef bool    boolean;
+
+// flash is ordinary memory here
+#define PROGMEM
+#define PGM_P                  const char*
+#define PSTR(s)                (s)
+#define F(s)                   (s)
+#define pgm_read_byte(addr)    (*(const uint8_t*)(addr))
+#define pgm_read_word(addr)    (*(const uint16_t*)(addr))
+#define pgm_read_dword(addr)   (*(const uint32_t*)(addr))
+#define pgm_read_ptr(addr)     (*(const void* const*)(addr))
+#define strcmp_P               strcmp
+#define strncmp_P              strncmp
+#define strncpy_P              strncpy
+#define strlen_P               strlen
+#define memcpy_P               memcpy
+#define snprintf_P             snprintf
+#define vsnprintf_P            vsnprintf
+
+void     pinMode(uint8_t pin, uint8_t mode);
+void     digitalWrite(uint8_t pin, uint8_t value);
+int      digitalRead(uint8_t pin);
+void     analogWrite(uint8_t pin, int value);
+
+uint32_t millis();
+uint32_t micros();
+void     delay(uint32_t ms);
+void     delayMicroseconds(unsigned int us);
+void     yield();
+
+void     noInterrupts();
+void     interrupts();
+
+class HardwareSerial
+{
+public:
+  void   begin(unsigned long baud);
+  int    available();
+  int    read();
+  int    availableForWrite();
+  size_t write(uint8_t c);
+  size_t write(const uint8_t* buf, size_t len);
+  size_t print(const char* str);
+  size_t print(long value, int base = DEC);
+  size_t println(const char* str);
+  size_t println(long value, int base = DEC);
+  void   flush();
+};
+
+extern HardwareSerial Serial;
+
+#endif /* Arduino_h */
@@ -0,0 +1,519 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "Arduino.h"
+#include "ds1961sim.h"
+#include "../OneWire.h"
+#include "../ds1961.h"
+
+// timing (us)
+#define T_RSTL                 480   // a low this long is a reset
+#define T_PDH                  30    // from the end of the reset to the presence pulse
+#define T_PDL                  120   // length of the presence pulse
+#define T_W1L                  15    // a write slot released before this is a 1
+#define T_HOLD                 30    // a 0 the button sends holds the line this long
+#define T_CSHA                 1500
+#define T_PROG                 10000
+
+#define STATE_IDLE             0     // waits for a reset
+#define STATE_ROM              1
+#define STATE_MATCH            2
+#define STATE_SEARCH           3
+#define STATE_FUNCTION         4
+#define STATE_ARGS             5
+#define STATE_SEND             6
+
+// what follows the bytes in the send buffer
+#define NEXT_FILL              0     // the fill byte, over and over
+#define NEXT_FUNCTION          1     // a memory command, after read ROM
+#define NEXT_MAC               2     // the MAC of a read authenticated page
+#define NEXT_STATUS            3
+
+#define ROM_READ               0x33
+#define ROM_MATCH              0x55
+#define ROM_SKIP               0xCC
+#define ROM_SEARCH             0xF0
+#define ROM_RESUME             0xA5
+
+#define CMD_WRITE_SCRATCHPAD   0x0F
+#define CMD_LOAD_FIRST_SECRET  0x5A
+#define CMD_REFRESH_SCRATCHPAD 0xA3
+#define CMD_READ_AUTH_PAGE     0xA5
+#define CMD_READ_SCRATCHPAD    0xAA
+#define CMD_READ_MEMORY        0xF0
+
+#define MEM_SECRET             0x80
+#define MEM_IDENTITY           0x90
+#define MEM_END                0x98
+
+#define ES_ENDING              0x07  // E2:E0, the last byte written
+#define ES_PF                  0x20  // partial flag
+#define ES_AA                  0x80  // authorization accepted
+
+#define STATUS_OK              0xAA
+#define STATUS_FAULT           0x55
+
+// bytes of arguments after a memory command, 0xFF for the ones it doesn't know
+static uint8_t ArgLength(uint8_t command)
+{
+  switch (command)
+  {
+    case CMD_WRITE_SCRATCHPAD:
+    case CMD_REFRESH_SCRATCHPAD:
+      return 2 + 8;
+    case CMD_READ_SCRATCHPAD:
+      return 0;
+    case CMD_LOAD_FIRST_SECRET:
+      return 3;
+    case CMD_READ_AUTH_PAGE:
+    case CMD_READ_MEMORY:
+      return 2;
+    default:
+      return 0xFF;
+  }
+}
+
+SimDS1961::SimDS1961(const uint8_t id[8], const uint8_t secret[8])
+{
+  memcpy(this->id, id, sizeof(this->id));
+  memcpy(this->secret, secret, sizeof(this->secret));
+  memset(memory, 0, sizeof(memory));
+  memset(scratchpad, 0xFF, sizeof(scratchpad));
+  ta = 0;
+  es = 0;
+  present = true;
+  resume = false;
+
+  state = STATE_IDLE;
+  txlen = 0;
+  txpos = 0;
+  txbit = 0;
+  txfill = 0xFF;
+  txnext = NEXT_FILL;
+  txready = 0;
+  txcount = 0;
+
+  fallat = 0;
+  holdfrom = 0;
+  holduntil = 0;
+
+  faultrate = 0;
+  faultmask = 0;
+  fault = 0;
+  seed = 1;
+
+  memset(&stats, 0, sizeof(stats));
+}
+
+void SimDS1961::SetPresent(bool present)
+{
+  //a touch starts with the button knowing nothing of the bus
+  if (present && !this->present)
+  {
+    state = STATE_IDLE;
+    resume = false;
+    holduntil = 0;
+  }
+
+  this->present = present;
+}
+
+bool SimDS1961::IsPresent()
+{
+  return present;
+}
+
+void SimDS1961::SetFaults(uint16_t permille, uint8_t mask, uint32_t seed)
+{
+  faultrate = permille;
+  faultmask = mask & SIMDS1961_FAULT_ALL;
+  this->seed = seed ? seed : 1;
+}
+
+const uint8_t* SimDS1961::GetSecret()
+{
+  return secret;
+}
+
+void SimDS1961::GetStats(simds1961stats* stats)
+{
+  *stats = this->stats;
+}
+
+void SimDS1961::ResetStats()
+{
+  memset(&stats, 0, sizeof(stats));
+}
+
+// xorshift32
+uint32_t SimDS1961::Random()
+{
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
+
+void SimDS1961::Reset(uint64_t now)
+{
+  stats.resets++;
+
+  fault = 0;
+  if (faultrate != 0 && faultmask != 0 && Random() % 1000 < faultrate)
+  {
+    while (!(fault & faultmask))
+      fault = 1 << (Random() % 3);
+
+    //early enough to land in the shortest answer, the CRC of a scratchpad write
+    faultbit = Random() % 16;
+    stats.faults++;
+  }
+
+  state = STATE_IDLE;
+  rxlen = 0;
+  rxbyte = 0;
+  rxbits = 0;
+  txcount = 0;
+
+  if (fault == SIMDS1961_FAULT_PRESENCE)
+    return;
+
+  holdfrom = now + T_PDH;
+  holduntil = holdfrom + T_PDL;
+  state = STATE_ROM;
+}
+
+void SimDS1961::MasterEdge(bool low, uint64_t now)
+{
+  if (!present)
+    return;
+
+  if (low)
+  {
+    fallat = now;
+
+    //in a read slot the button answers a 0 by holding the line past the
+    //moment the master samples it
+    uint8_t bit = 1;
+    if (state == STATE_SEND && now >= txready)
+      bit = NextBit();
+    else if (state == STATE_SEARCH && searchphase < 2)
+      bit = SearchBit();
+
+    if (!bit)
+    {
+      holdfrom = now;
+      holduntil = now + T_HOLD;
+    }
+
+    return;
+  }
+
+  uint64_t duration = now - fallat;
+  if (duration >= T_RSTL)
+  {
+    Reset(now);
+    return;
+  }
+
+  if (state == STATE_IDLE)
+  {
+    return;
+  }
+  else if (state == STATE_SEND)
+  {
+    //slots while it's still busy read as ones and send nothing
+    if (fallat >= txready)
+      SentBit(now);
+  }
+  else if (state == STATE_SEARCH)
+  {
+    if (searchphase < 2)
+    {
+      txcount++;
+      searchphase++;
+      return;
+    }
+
+    uint8_t bit = duration < T_W1L;
+    searchphase = 0;
+    if (bit != ((id[searchbit / 8] >> (searchbit % 8)) & 1))
+    {
+      state = STATE_IDLE;
+    }
+    else if (++searchbit == 64)
+    {
+      stats.selects++;
+      resume = true;
+      state = STATE_FUNCTION;
+    }
+  }
+  else
+  {
+    ReceiveBit(duration < T_W1L, now);
+  }
+}
+
+bool SimDS1961::HoldsLow(uint64_t now)
+{
+  return present && now >= holdfrom && now < holduntil;
+}
+
+void SimDS1961::ReceiveBit(uint8_t bit, uint64_t now)
+{
+  rxbyte |= bit << rxbits;
+  if (++rxbits < 8)
+    return;
+
+  uint8_t value = rxbyte;
+  rxbyte = 0;
+  rxbits = 0;
+  Receive(value, now);
+}
+
+void SimDS1961::Receive(uint8_t value, uint64_t now)
+{
+  if (state == STATE_ROM)
+  {
+    if (value == ROM_READ)
+    {
+      stats.selects++;
+      resume = true;
+      Send(id, sizeof(id), NEXT_FUNCTION);
+    }
+    else if (value == ROM_MATCH)
+    {
+      state = STATE_MATCH;
+    }
+    else if (value == ROM_SKIP)
+    {
+      stats.selects++;
+      resume = false;
+      state = STATE_FUNCTION;
+    }
+    else if (value == ROM_SEARCH)
+    {
+      searchbit = 0;
+      searchphase = 0;
+      state = STATE_SEARCH;
+    }
+    else if (value == ROM_RESUME && resume)
+    {
+      stats.selects++;
+      state = STATE_FUNCTION;
+    }
+    else
+    {
+      state = STATE_IDLE;
+    }
+  }
+  else if (state == STATE_MATCH)
+  {
+    if (value != id[rxlen++])
+    {
+      resume = false;
+      state = STATE_IDLE;
+    }
+    else if (rxlen == sizeof(id))
+    {
+      stats.selects++;
+      resume = true;
+      rxlen = 0;
+      state = STATE_FUNCTION;
+    }
+  }
+  else if (state == STATE_FUNCTION)
+  {
+    command = value;
+    rxlen = 0;
+    if (ArgLength(command) == 0)
+      ReceiveCommand(now);
+    else if (ArgLength(command) == 0xFF)
+      state = STATE_IDLE;
+    else
+      state = STATE_ARGS;
+  }
+  else if (state == STATE_ARGS)
+  {
+    rx[rxlen++] = value;
+    if (rxlen == ArgLength(command))
+      ReceiveCommand(now);
+  }
+}
+
+void SimDS1961::ReceiveCommand(uint64_t now)
+{
+  uint16_t addr = rx[0] | (rx[1] << 8);
+  uint8_t  buf[3 + 32 + 1];
+
+  buf[0] = command;
+
+  if (command == CMD_WRITE_SCRATCHPAD || command == CMD_REFRESH_SCRATCHPAD)
+  {
+    //a refresh takes the data from the master like a write, all WriteData()
+    //needs from it
+    ta = addr;
+    es = ES_ENDING;
+    memcpy(scratchpad, rx + 2, sizeof(scratchpad));
+
+    memcpy(buf + 1, rx, 10);
+    Send(NULL, 0, NEXT_FILL);
+    AddCRC(buf, 11);
+  }
+  else if (command == CMD_READ_SCRATCHPAD)
+  {
+    buf[1] = ta & 0xFF;
+    buf[2] = ta >> 8;
+    buf[3] = es;
+    memcpy(buf + 4, scratchpad, sizeof(scratchpad));
+
+    Send(buf + 1, 11, NEXT_FILL);
+    AddCRC(buf, 12);
+  }
+  else if (command == CMD_LOAD_FIRST_SECRET)
+  {
+    //the master has to send back what read scratchpad told it
+    if (addr != ta || rx[2] != es || (es & ES_PF))
+    {
+      state = STATE_IDLE;
+      return;
+    }
+
+    if (ta == MEM_SECRET)
+    {
+      memcpy(secret, scratchpad, sizeof(secret));
+      stats.secrets++;
+    }
+    else if (ta < MEM_SECRET)
+    {
+      memcpy(memory + (ta & ~7), scratchpad, sizeof(scratchpad));
+    }
+
+    es |= ES_AA;
+    SendStatus(now + T_PROG);
+  }
+  else if (command == CMD_READ_AUTH_PAGE)
+  {
+    if (addr >= MEM_SECRET)
+    {
+      state = STATE_IDLE;
+      return;
+    }
+
+    //the rest of the page, then 0xFF, with the command and address in the CRC
+    uint8_t len = 32 - (addr & 31);
+    buf[1] = rx[0];
+    buf[2] = rx[1];
+    memcpy(buf + 3, memory + addr, len);
+    buf[3 + len] = 0xFF;
+
+    Send(buf + 3, len + 1, NEXT_MAC);
+    AddCRC(buf, 3 + len + 1);
+  }
+  else if (command == CMD_READ_MEMORY)
+  {
+    uint8_t data[MEM_END];
+    uint8_t len = 0;
+
+    //the secret reads as ones
+    for (uint16_t a = addr; a < MEM_END; a++)
+    {
+      if (a < MEM_SECRET)
+        data[len++] = memory[a];
+      else if (a >= MEM_IDENTITY)
+        data[len++] = id[a - MEM_IDENTITY];
+      else
+        data[len++] = 0xFF;
+    }
+
+    Send(data, len, NEXT_FILL);
+  }
+}
+
+void SimDS1961::Send(const uint8_t* data, uint8_t len, uint8_t next)
+{
+  if (len != 0)
+    memcpy(tx, data, len);
+
+  txlen = len;
+  txpos = 0;
+  txbit = 0;
+  txfill = 0xFF;
+  txnext = next;
+  txready = 0;
+  state = STATE_SEND;
+}
+
+// adds the inverted CRC16 of data to what is sent, low byte first
+void SimDS1961::AddCRC(const uint8_t* data, uint8_t len)
+{
+  uint16_t crc = ~OneWire::crc16(data, len);
+  tx[txlen++] = crc & 0xFF;
+  tx[txlen++] = crc >> 8;
+}
+
+void SimDS1961::SendStatus(uint64_t ready)
+{
+  Send(NULL, 0, NEXT_FILL);
+  txfill = fault == SIMDS1961_FAULT_STATUS ? STATUS_FAULT : STATUS_OK;
+  txready = ready;
+}
+
+uint8_t SimDS1961::Flip(uint8_t bit)
+{
+  if (fault == SIMDS1961_FAULT_BIT && txcount == faultbit)
+    return bit ^ 1;
+
+  return bit;
+}
+
+uint8_t SimDS1961::NextBit()
+{
+  uint8_t value = txpos < txlen ? tx[txpos] : txfill;
+  return Flip((value >> txbit) & 1);
+}
+
+// the bit of the id in the first read slot, its complement in the second
+uint8_t SimDS1961::SearchBit()
+{
+  uint8_t bit = (id[searchbit / 8] >> (searchbit % 8)) & 1;
+  return Flip(searchphase == 0 ? bit : bit ^ 1);
+}
+
+void SimDS1961::SentBit(uint64_t now)
+{
+  txcount++;
+  if (++txbit < 8)
+    return;
+
+  txbit = 0;
+  if (txpos < txlen && ++txpos == txlen)
+    Sent(now);
+}
+
+void SimDS1961::Sent(uint64_t now)
+{
+  if (txnext == NEXT_FUNCTION)
+  {
+    rxbits = 0;
+    state = STATE_FUNCTION;
+  }
+  else if (txnext == NEXT_MAC)
+  {
+    //the challenge is in bytes 4 to 6 of the scratchpad, ComputeMAC() has
+    //the number of page 0 in its input, the only page the lock reads
+    uint8_t mac[20];
+    uint16_t page = (rx[0] | (rx[1] << 8)) & ~31;
+    DS1961::ComputeMAC(id, secret, memory + page, scratchpad + 4, mac);
+    stats.authreads++;
+
+    Send(mac, sizeof(mac), NEXT_STATUS);
+    AddCRC(mac, sizeof(mac));
+    txready = now + T_CSHA;
+  }
+  else if (txnext == NEXT_STATUS)
+  {
+    SendStatus(now);
+  }
+}
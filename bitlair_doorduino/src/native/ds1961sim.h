@@ -0,0 +1,110 @@
+#ifndef _DS1961SIM_H_
+#define _DS1961SIM_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sim.h"
+
+// A DS1961S iButton on a simulated 1-Wire pin. It decodes the slots from the
+// edges the master makes and answers with the timing of the datasheet, so
+// OneWire, DS1961 and AuthenticateButton() run against it unchanged.
+//
+// It knows the ROM commands read, match, skip, search and resume, and the
+// memory commands write, refresh and read scratchpad, load first secret, read
+// authenticated page and read memory. Copy scratchpad and compute next secret
+// aren't emulated, the firmware doesn't use them, the button goes quiet on
+// them like it does on an unknown command.
+
+// what a transaction can go wrong with, drawn for a SetFaults() share of the
+// resets
+#define SIMDS1961_FAULT_PRESENCE 0x01  // no presence pulse
+#define SIMDS1961_FAULT_BIT      0x02  // one bit the button sends is flipped
+#define SIMDS1961_FAULT_STATUS   0x04  // a wrong status byte after a command
+#define SIMDS1961_FAULT_ALL      0x07
+
+struct simds1961stats
+{
+  uint32_t resets;    // resets seen while touching the reader
+  uint32_t selects;   // a match, search or skip that selected this button
+  uint32_t authreads; // MACs sent for an authenticated page read
+  uint32_t secrets;   // secrets loaded
+  uint32_t faults;    // faults injected
+};
+
+class SimDS1961 : public SimWireDevice
+{
+public:
+  SimDS1961(const uint8_t id[8], const uint8_t secret[8]);
+
+  // a button that isn't touching the reader doesn't see or drive the line
+  void SetPresent(bool present);
+  bool IsPresent();
+
+  // injects one of the faults in mask into permille of the transactions,
+  // drawn from a generator seeded with seed so a run can be repeated
+  void SetFaults(uint16_t permille, uint8_t mask, uint32_t seed);
+
+  const uint8_t* GetSecret();
+  void GetStats(simds1961stats* stats);
+  void ResetStats();
+
+  void MasterEdge(bool low, uint64_t now);
+  bool HoldsLow(uint64_t now);
+
+private:
+  uint8_t  id[8];
+  uint8_t  secret[8];
+  uint8_t  memory[128];
+  uint8_t  scratchpad[8];
+  uint16_t ta;
+  uint8_t  es;
+  bool     present;
+  bool     resume;
+
+  uint8_t  state;
+  uint8_t  command;
+  uint8_t  rx[16];
+  uint8_t  rxlen;
+  uint8_t  rxbyte;
+  uint8_t  rxbits;
+  uint8_t  searchbit;
+  uint8_t  searchphase;
+
+  uint8_t  tx[160];
+  uint8_t  txlen;
+  uint8_t  txpos;
+  uint8_t  txbit;
+  uint8_t  txfill;    // sent after the buffer, 0xFF lets the line float
+  uint8_t  txnext;    // what follows the buffer
+  uint64_t txready;   // the button is busy computing until then
+  uint16_t txcount;   // bits sent since the reset
+
+  uint64_t fallat;
+  uint64_t holdfrom;
+  uint64_t holduntil;
+
+  uint16_t faultrate;
+  uint8_t  faultmask;
+  uint8_t  fault;
+  uint16_t faultbit;
+  uint32_t seed;
+
+  simds1961stats stats;
+
+  uint32_t Random();
+  void Reset(uint64_t now);
+  void ReceiveBit(uint8_t bit, uint64_t now);
+  void Receive(uint8_t value, uint64_t now);
+  void ReceiveCommand(uint64_t now);
+  void Send(const uint8_t* data, uint8_t len, uint8_t next);
+  void AddCRC(const uint8_t* data, uint8_t len);
+  void SendStatus(uint64_t ready);
+  uint8_t Flip(uint8_t bit);
+  uint8_t NextBit();
+  uint8_t SearchBit();
+  void SentBit(uint64_t now);
+  void Sent(uint64_t now);
+};
+
+#endif /* _DS1961SIM_H_ */
@@ -0,0 +1,142 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "eepromsim.h"
+
+SimEeprom::SimEeprom(uint16_t size, uint8_t pagesize, uint32_t writecycle)
+{
+  mem = (uint8_t*)malloc(size);
+  memset(mem, 0xFF, size);
+  this->size = size;
+  this->pagesize = pagesize;
+  this->writecycle = writecycle;
+  address = 0;
+  busyuntil = 0;
+
+  powerloss = 0;
+  seed = 1;
+  powerlost = false;
+
+  memset(&stats, 0, sizeof(stats));
+}
+
+SimEeprom::~SimEeprom()
+{
+  free(mem);
+}
+
+void SimEeprom::SetPowerLoss(uint32_t cycle, uint32_t seed)
+{
+  powerloss = cycle;
+  this->seed = seed ? seed : 1;
+}
+
+bool SimEeprom::PowerLost()
+{
+  return powerlost;
+}
+
+bool SimEeprom::Load(const char* path)
+{
+  FILE* file = fopen(path, "rb");
+  if (!file)
+    return false;
+
+  size_t len = fread(mem, 1, size, file);
+  fclose(file);
+
+  return len == size;
+}
+
+bool SimEeprom::Save(const char* path)
+{
+  FILE* file = fopen(path, "wb");
+  if (!file)
+    return false;
+
+  size_t len = fwrite(mem, 1, size, file);
+  return fclose(file) == 0 && len == size;
+}
+
+void SimEeprom::GetStats(simeepromstats* stats)
+{
+  *stats = this->stats;
+}
+
+void SimEeprom::ResetStats()
+{
+  memset(&stats, 0, sizeof(stats));
+}
+
+uint8_t SimEeprom::Transfer(const uint8_t* tx, uint8_t txlen, uint8_t* rx, uint8_t rxlen, uint64_t now)
+{
+  stats.transfers++;
+
+  //busy with a write cycle, or without power
+  if (powerlost || now < busyuntil)
+  {
+    stats.nacks++;
+    stats.bytes++;
+    stats.busus += SimTwiMicros(txlen, rxlen, SIM_TWI_ADDRNACK);
+    return SIM_TWI_ADDRNACK;
+  }
+
+  stats.bytes += 1 + txlen + (rxlen ? 1 + rxlen : 0);
+  stats.busus += SimTwiMicros(txlen, rxlen, SIM_TWI_ACK);
+
+  if (txlen >= 2)
+    address = ((tx[0] << 8) | tx[1]) % size;
+
+  //data after the address is a page write, a read after it a random read
+  if (txlen > 2)
+  {
+    Write(tx + 2, txlen - 2);
+    busyuntil = now + SimTwiMicros(txlen, rxlen, SIM_TWI_ACK) + writecycle;
+  }
+
+  for (uint8_t i = 0; i < rxlen; i++)
+  {
+    rx[i] = mem[address];
+    address = (address + 1) % size;
+  }
+  stats.read += rxlen;
+
+  return SIM_TWI_ACK;
+}
+
+// the address counter only counts within the page, the rest of the address
+// stays where the write started
+void SimEeprom::Write(const uint8_t* data, uint8_t len)
+{
+  uint16_t page = address - address % pagesize;
+  uint8_t  offset = address % pagesize;
+
+  //more than a page overwrites its own start, only the last bytes are kept
+  if (len > pagesize)
+  {
+    offset = (offset + len - pagesize) % pagesize;
+    data += len - pagesize;
+    len = pagesize;
+  }
+
+  stats.writecycles++;
+  stats.written += len;
+
+  if (powerloss != 0 && stats.writecycles == powerloss)
+  {
+    //xorshift32, how far the cycle got
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    len = seed % len;
+    powerlost = true;
+  }
+
+  for (uint8_t i = 0; i < len; i++)
+    mem[page + (offset + i) % pagesize] = data[i];
+
+  address = page + (offset + len) % pagesize;
+}
@@ -0,0 +1,69 @@
+#ifndef _EEPROMSIM_H_
+#define _EEPROMSIM_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sim.h"
+
+// A 24Cxx I2C EEPROM with two address bytes. Like the real part it:
+//  - wraps a write that runs past the end of a page to the start of that page
+//  - starts its write cycle at the stop after a write with data, and doesn't
+//    acknowledge its address until the cycle is over
+//  - reads on from the last address, wrapping at the end of the memory
+//
+// SetPowerLoss() cuts the power in the middle of a write cycle. Only the
+// start of the page write makes it into the memory, after that the part
+// doesn't answer anymore. Save() and Load() keep the memory in a file, so a
+// next run boots from what was left behind.
+
+#define SIMEEPROM_WRITECYCLE   5000  // us, the tWR of the datasheet
+
+struct simeepromstats
+{
+  uint32_t transfers;
+  uint32_t nacks;       // transfers it didn't acknowledge its address for
+  uint32_t bytes;       // bytes on the bus, with the address bytes
+  uint32_t written;     // data bytes written
+  uint32_t read;
+  uint32_t writecycles;
+  uint64_t busus;       // time on the bus, nacked transfers too
+};
+
+class SimEeprom : public SimTwiDevice
+{
+public:
+  SimEeprom(uint16_t size, uint8_t pagesize, uint32_t writecycle = SIMEEPROM_WRITECYCLE);
+  ~SimEeprom();
+
+  // write cycle number cycle, counting from 1, gets cut off after a share of
+  // its bytes drawn from a generator seeded with seed, 0 turns it off
+  void SetPowerLoss(uint32_t cycle, uint32_t seed);
+  bool PowerLost();
+
+  bool Load(const char* path);
+  bool Save(const char* path);
+
+  void GetStats(simeepromstats* stats);
+  void ResetStats();
+
+  uint8_t Transfer(const uint8_t* tx, uint8_t txlen, uint8_t* rx, uint8_t rxlen, uint64_t now);
+
+private:
+  uint8_t* mem;
+  uint16_t size;
+  uint8_t  pagesize;
+  uint32_t writecycle;
+  uint16_t address;
+  uint64_t busyuntil;
+
+  uint32_t powerloss;
+  uint32_t seed;
+  bool     powerlost;
+
+  simeepromstats stats;
+
+  void Write(const uint8_t* data, uint8_t len);
+};
+
+#endif /* _EEPROMSIM_H_ */
@@ -0,0 +1,335 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "replaysim.h"
+
+// timing (us), as the DS1961S of ds1961sim.cpp
+#define T_RSTL                 480   // a low this long is a reset
+#define T_PDH                  30    // from the end of the reset to the presence pulse
+#define T_PDL                  120   // length of the presence pulse
+#define T_W1L                  15    // a write slot released before this is a 1
+#define T_HOLD                 30    // a 0 read holds the line this long
+
+// an event is its type in bits 1 and 2 and its value in bit 0
+#define EVENT_RESET            0x00  // the value is the presence
+#define EVENT_READ             0x02
+#define EVENT_WRITE            0x04
+#define EVENT_TYPE             0x06
+
+#define REPLAY_LINESIZE        256
+
+#define ROM_MATCH              0x55
+#define ROM_SEARCH             0xF0
+#define CMD_WRITE_SCRATCHPAD   0x0F
+#define MEM_SECRET             0x80
+
+SimReplay::SimReplay(uint8_t pin)
+{
+  this->pin = pin;
+  events = NULL;
+  count = 0;
+  size = 0;
+  pos = 0;
+  transactions = 0;
+  active = false;
+
+  fallat = 0;
+  holdfrom = 0;
+  holduntil = 0;
+
+  memset(&stats, 0, sizeof(stats));
+}
+
+SimReplay::~SimReplay()
+{
+  free(events);
+}
+
+void SimReplay::Add(uint8_t event)
+{
+  if (count == size)
+  {
+    size = size ? size * 2 : 1024;
+    events = (uint8_t*)realloc(events, size);
+  }
+
+  events[count++] = event;
+}
+
+// least significant bit first, like on the bus
+void SimReplay::AddByte(uint8_t type, uint8_t value)
+{
+  for (uint8_t i = 0; i < 8; i++)
+    Add(type | ((value >> i) & 1));
+}
+
+// the bits of a search for the only button on the reader, a search that found
+// nothing reads no device at all
+void SimReplay::AddSearch(const uint8_t id[8], bool found)
+{
+  if (!found)
+  {
+    Add(EVENT_READ | 1);
+    Add(EVENT_READ | 1);
+    return;
+  }
+
+  for (uint8_t i = 0; i < 64; i++)
+  {
+    uint8_t bit = (id[i / 8] >> (i % 8)) & 1;
+    Add(EVENT_READ | bit);
+    Add(EVENT_READ | !bit);
+    Add(EVENT_WRITE | bit);
+  }
+}
+
+// the bytes written from event from on, until something else than a write
+uint8_t SimReplay::GetWritten(uint32_t from, uint8_t* out, uint8_t max)
+{
+  uint8_t len = 0;
+  for (uint32_t i = from; len < max && i + 8 <= count; i += 8)
+  {
+    uint8_t value = 0;
+    for (uint8_t j = 0; j < 8; j++)
+    {
+      if ((events[i + j] & EVENT_TYPE) != EVENT_WRITE)
+        return len;
+      value |= (events[i + j] & 1) << j;
+    }
+    out[len++] = value;
+  }
+
+  return len;
+}
+
+void SimReplay::SearchFirst()
+{
+  uint32_t first = 0;
+  while (first < count && events[first] != (EVENT_RESET | 1))
+    first++;
+
+  uint8_t select[9];
+  if (first == count || GetWritten(first + 1, select, sizeof(select)) != sizeof(select) || select[0] != ROM_MATCH)
+    return;
+
+  //the transaction goes after the events, then moves in front of them
+  uint32_t end = count;
+  Add(EVENT_RESET | 1);
+  AddByte(EVENT_WRITE, ROM_SEARCH);
+  AddSearch(select + 1, true);
+
+  uint32_t len = count - end;
+  uint8_t* search = (uint8_t*)malloc(len);
+  memcpy(search, events + end, len);
+  memmove(events + first + len, events + first, end - first);
+  memcpy(events + first, search, len);
+  free(search);
+
+  transactions++;
+}
+
+uint32_t SimReplay::GetChallenges(uint8_t* out, uint32_t max)
+{
+  uint32_t len = 0;
+  for (uint32_t i = 0; i < count; i++)
+  {
+    if (events[i] != (EVENT_RESET | 1))
+      continue;
+
+    //a match, a scratchpad write below the secret and its 8 bytes, the
+    //challenge is in bytes 4 to 6 of them
+    uint8_t written[20];
+    if (GetWritten(i + 1, written, sizeof(written)) != sizeof(written) || written[0] != ROM_MATCH ||
+        written[9] != CMD_WRITE_SCRATCHPAD || written[11] != 0 || written[10] >= MEM_SECRET)
+      continue;
+
+    const uint8_t* challenge = written + 12 + 4;
+    if (len >= 3 && memcmp(out + len - 3, challenge, 3) == 0)
+      continue;
+    if (len + 3 > max)
+      break;
+
+    memcpy(out + len, challenge, 3);
+    len += 3;
+  }
+
+  return len;
+}
+
+bool SimReplay::Load(const char* path)
+{
+  FILE* file = fopen(path, "r");
+  if (!file)
+    return false;
+
+  //the bytes and bits belong to the pin of the reset before them
+  bool mine = false;
+  uint32_t start = 0;
+  unsigned int repeats = 0;
+  char line[REPLAY_LINESIZE];
+  bool more = true;
+  while (more)
+  {
+    more = fgets(line, sizeof(line), file) != NULL;
+    char* capture = more ? strstr(line, "capture ") : NULL;
+
+    //a transaction that repeated plays that many more times
+    if ((!more || (capture && strncmp(capture, "capture reset ", 14) == 0)) && mine)
+    {
+      uint32_t end = count;
+      for (unsigned int i = 0; i < repeats; i++)
+      {
+        for (uint32_t j = start; j < end; j++)
+          Add(events[j]);
+      }
+      transactions += repeats;
+      mine = false;
+    }
+
+    if (!capture)
+      continue;
+
+    char type[8];
+    char data[REPLAY_LINESIZE];
+    if (sscanf(capture, "capture %7s %255s", type, data) != 2)
+      continue;
+
+    if (strcmp(type, "reset") == 0)
+    {
+      unsigned int resetpin;
+      unsigned int presence;
+      unsigned int ms;
+      repeats = 0;
+      mine = sscanf(capture, "capture reset %u %u %u %u", &resetpin, &presence, &ms, &repeats) >= 2 && resetpin == pin;
+      if (mine)
+      {
+        start = count;
+        Add(EVENT_RESET | (presence ? 1 : 0));
+        transactions++;
+      }
+    }
+    else if (!mine)
+    {
+      continue;
+    }
+    else if (strcmp(type, "w") == 0 || strcmp(type, "r") == 0)
+    {
+      uint8_t event = type[0] == 'w' ? EVENT_WRITE : EVENT_READ;
+      for (char* hex = data; hex[0] && hex[1]; hex += 2)
+      {
+        unsigned int value;
+        if (sscanf(hex, "%2x", &value) != 1)
+          break;
+        AddByte(event, value);
+      }
+    }
+    else if (strcmp(type, "search") == 0)
+    {
+      unsigned int found;
+      char hex[17];
+      uint8_t id[8];
+      bool ok = sscanf(capture, "capture search %u %16s", &found, hex) == 2 && strlen(hex) == 16;
+      for (uint8_t i = 0; ok && i < 8; i++)
+      {
+        unsigned int value;
+        ok = sscanf(hex + i * 2, "%2x", &value) == 1;
+        id[i] = value;
+      }
+      if (ok)
+        AddSearch(id, found);
+    }
+    else if (strcmp(type, "bits") == 0)
+    {
+      for (char* bit = data; bit[0] && bit[1]; bit += 2)
+        Add((bit[0] == 'w' ? EVENT_WRITE : EVENT_READ) | (bit[1] == '1'));
+    }
+  }
+  fclose(file);
+
+  SearchFirst();
+
+  return true;
+}
+
+uint32_t SimReplay::GetTransactions()
+{
+  return transactions;
+}
+
+bool SimReplay::Done()
+{
+  return pos >= count;
+}
+
+void SimReplay::GetStats(simreplaystats* stats)
+{
+  *stats = this->stats;
+}
+
+void SimReplay::Reset(uint64_t now)
+{
+  stats.resets++;
+  active = false;
+
+  //what's left of a transaction the master broke off
+  while (pos < count && (events[pos] & EVENT_TYPE) != EVENT_RESET)
+  {
+    pos++;
+    stats.skipped++;
+  }
+
+  if (pos >= count)
+    return;
+
+  stats.transactions++;
+  if (events[pos++] & 1)
+  {
+    active = true;
+    holdfrom = now + T_PDH;
+    holduntil = holdfrom + T_PDL;
+  }
+}
+
+void SimReplay::MasterEdge(bool low, uint64_t now)
+{
+  if (low)
+  {
+    fallat = now;
+
+    //a 0 that was read holds the line past the moment the master samples it
+    if (active && pos < count && events[pos] == EVENT_READ)
+    {
+      holdfrom = now;
+      holduntil = now + T_HOLD;
+    }
+    return;
+  }
+
+  uint64_t duration = now - fallat;
+  if (duration >= T_RSTL)
+  {
+    Reset(now);
+    return;
+  }
+
+  if (!active)
+    return;
+
+  if (pos >= count || (events[pos] & EVENT_TYPE) == EVENT_RESET)
+  {
+    stats.extra++;
+    return;
+  }
+
+  uint8_t event = events[pos++];
+  if ((event & EVENT_TYPE) == EVENT_WRITE && (duration < T_W1L) != (event & 1))
+    stats.mismatches++;
+}
+
+bool SimReplay::HoldsLow(uint64_t now)
+{
+  return now >= holdfrom && now < holduntil;
+}
@@ -0,0 +1,77 @@
+#ifndef _REPLAYSIM_H_
+#define _REPLAYSIM_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sim.h"
+
+// Plays the transactions of one pin from a capture dump, see capture.h, back
+// to the master on a simulated 1-Wire pin. Every reset gets the presence of
+// the next recorded reset, every read slot the next bit that was read, and
+// every write slot is checked against the next bit that was written.
+//
+// Written bits that differ from the capture count as mismatches and the
+// replay goes on. The firmware has to write the same challenges for the
+// button's answers to fit, GetChallenges() gives them for SimEntropyForce().
+// A reset before the end of a recorded transaction skips the rest of it,
+// slots past its end read ones. After the last transaction the reader is
+// empty. A dump that starts halfway an authentication gets the search that
+// found the button put in front.
+
+struct simreplaystats
+{
+  uint32_t resets;        // resets the master made
+  uint32_t transactions;  // recorded resets played back
+  uint32_t mismatches;    // written bits that differed from the capture
+  uint32_t skipped;       // recorded bits skipped by an early reset
+  uint32_t extra;         // slots past the end of a transaction
+};
+
+class SimReplay : public SimWireDevice
+{
+public:
+  SimReplay(uint8_t pin);
+  ~SimReplay();
+
+  // reads the capture lines of this pin from a file, other lines are
+  // ignored, so a whole serial log will do
+  bool Load(const char* path);
+
+  uint32_t GetTransactions();
+
+  // the challenges of the authenticated reads, 3 bytes each, in order, a
+  // retry with the same challenge only counts once
+  uint32_t GetChallenges(uint8_t* out, uint32_t max);
+
+  bool Done();
+
+  void GetStats(simreplaystats* stats);
+
+  void MasterEdge(bool low, uint64_t now);
+  bool HoldsLow(uint64_t now);
+
+private:
+  uint8_t  pin;
+  uint8_t* events;
+  uint32_t count;
+  uint32_t size;
+  uint32_t pos;
+  uint32_t transactions;
+  bool     active;   // answered the last reset
+
+  uint64_t fallat;
+  uint64_t holdfrom;
+  uint64_t holduntil;
+
+  simreplaystats stats;
+
+  void Add(uint8_t event);
+  void AddByte(uint8_t type, uint8_t value);
+  void AddSearch(const uint8_t id[8], bool found);
+  uint8_t GetWritten(uint32_t from, uint8_t* out, uint8_t max);
+  void SearchFirst();
+  void Reset(uint64_t now);
+};
+
+#endif /* _REPLAYSIM_H_ */
@@ -0,0 +1,485 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Arduino.h"
+#include "scenario.h"
+#include "sim.h"
+#include "../leds.h"
+#include "../power.h"
+
+#define SCENARIO_MAXSTEPS      256
+#define SCENARIO_MAXEXPECTS    64
+#define SCENARIO_TEXTSIZE      96
+#define SCENARIO_LINESIZE      256
+#define SCENARIO_TAIL          1000  // ms run after the last step
+
+#define STEP_SERIAL            0
+#define STEP_TOUCH             1
+#define STEP_UNTOUCH           2
+#define STEP_INPUT             3
+
+#define EXPECT_PIN             0
+#define EXPECT_SERIAL          1
+
+struct scenariopin
+{
+  const char* name;
+  uint8_t     pin;
+};
+
+// the pins of main.cpp
+static const scenariopin g_outputs[] =
+{
+  { "close",       A0 },
+  { "open",        13 },
+  { "doorpower",   A1 },
+  { "solenoid",    A3 },
+  { "horn",        A2 },
+  { "ledsolenoid", 6 },
+  { "ledhorn",     5 },
+  { "ledgreen",    PIN_LEDGREEN },
+  { "ledred",      PIN_LEDRED },
+};
+
+static const scenariopin g_inputs[] =
+{
+  { "hornbutton",  3 },
+  { "openbutton",  7 },
+  { "doordone",    4 },
+};
+
+struct scenariostep
+{
+  uint32_t at;
+  uint8_t  kind;
+  uint8_t  pin;
+  uint8_t  level;
+  char     text[SCENARIO_TEXTSIZE];  // the command, or the step as written
+};
+
+struct scenarioexpect
+{
+  uint32_t from;
+  uint32_t within;
+  uint8_t  kind;
+  uint8_t  pin;
+  uint8_t  level;
+  char     text[SCENARIO_TEXTSIZE];
+  bool     met;
+  uint64_t at;     // us
+};
+
+static scenariostep   g_steps[SCENARIO_MAXSTEPS];
+static uint16_t       g_stepcount;
+static uint16_t       g_nextstep;
+static scenarioexpect g_expects[SCENARIO_MAXEXPECTS];
+static uint16_t       g_expectcount;
+static uint32_t       g_end;
+static bool           g_traceleds;
+static SimDS1961*     g_button;
+
+static char           g_serialline[SCENARIO_LINESIZE];
+static size_t         g_seriallen;
+
+static unsigned long  g_firstevent;   // seq of the first event line, 0 before it
+static unsigned long  g_lastevent;
+static unsigned long  g_missingevent; // the first seq that was skipped, 0 if none
+
+static void PrintTime(uint64_t us)
+{
+  printf("[%7llu.%03llu] ", (unsigned long long)(us / 1000), (unsigned long long)(us % 1000));
+}
+
+static const scenariopin* FindPin(const scenariopin* pins, size_t count, const char* name)
+{
+  for (size_t i = 0; i < count; i++)
+  {
+    if (name && strcmp(pins[i].name, name) == 0)
+      return &pins[i];
+  }
+
+  return NULL;
+}
+
+static const char* OutputName(uint8_t pin)
+{
+  for (size_t i = 0; i < sizeof(g_outputs) / sizeof(g_outputs[0]); i++)
+  {
+    if (g_outputs[i].pin == pin)
+      return g_outputs[i].name;
+  }
+
+  return NULL;
+}
+
+static void PinChanged(uint8_t pin, int value)
+{
+  const char* name = OutputName(pin);
+  if (!name)
+    return;
+
+  //only off and full brightness count for the LEDs, not the fading between
+  bool led = pin == PIN_LEDGREEN || pin == PIN_LEDRED;
+  uint8_t level;
+  if (!led)
+    level = value ? HIGH : LOW;
+  else if (value == 255)
+    level = HIGH;
+  else if (value == 0)
+    level = LOW;
+  else
+    return;
+
+  uint64_t now = SimMicros();
+  if (!led || g_traceleds)
+  {
+    PrintTime(now);
+    printf("pin %s %s\n", name, level ? "high" : "low");
+  }
+
+  for (uint16_t i = 0; i < g_expectcount; i++)
+  {
+    scenarioexpect* e = &g_expects[i];
+    if (!e->met && e->kind == EXPECT_PIN && e->pin == pin && e->level == level && now >= (uint64_t)e->from * 1000)
+    {
+      e->met = true;
+      e->at = now;
+    }
+  }
+}
+
+static void SerialOut(uint8_t c)
+{
+  if (c == '\r')
+    return;
+
+  if (c != '\n')
+  {
+    if (g_seriallen < sizeof(g_serialline) - 1)
+      g_serialline[g_seriallen++] = c;
+    return;
+  }
+
+  g_serialline[g_seriallen] = 0;
+  g_seriallen = 0;
+
+  uint64_t now = SimMicros();
+  PrintTime(now);
+  printf("serial %s\n", g_serialline);
+
+  //a seq lower than the last is a replay_since, one higher than the next a lost line
+  unsigned long seq;
+  if (sscanf(g_serialline, "event %lu ", &seq) == 1)
+  {
+    if (g_firstevent == 0)
+      g_firstevent = seq;
+    else if (seq > g_lastevent + 1 && g_missingevent == 0)
+      g_missingevent = g_lastevent + 1;
+
+    if (seq > g_lastevent)
+      g_lastevent = seq;
+  }
+
+  for (uint16_t i = 0; i < g_expectcount; i++)
+  {
+    scenarioexpect* e = &g_expects[i];
+    if (!e->met && e->kind == EXPECT_SERIAL && strstr(g_serialline, e->text) && now >= (uint64_t)e->from * 1000)
+    {
+      e->met = true;
+      e->at = now;
+    }
+  }
+}
+
+// splits off the next word, leaves rest after the spaces that follow it
+static char* NextWord(char** rest)
+{
+  char* word = *rest + strspn(*rest, " \t");
+  if (*word == 0)
+    return NULL;
+
+  char* end = word + strcspn(word, " \t");
+  *rest = end + strspn(end, " \t");
+  *end = 0;
+
+  return word;
+}
+
+static bool ParseNumber(const char* word, uint32_t* value)
+{
+  if (!word || !*word)
+    return false;
+
+  char* end;
+  *value = strtoul(word, &end, 10);
+  return *end == 0;
+}
+
+static bool ParseStep(char* rest, scenariostep* step)
+{
+  char* word = NextWord(&rest);
+  char* arg = NextWord(&rest);
+
+  if (word && strcmp(word, "serial") == 0 && arg)
+  {
+    //the command is the rest of the line
+    arg[strlen(arg)] = rest[0] ? ' ' : 0;
+    step->kind = STEP_SERIAL;
+    snprintf(step->text, sizeof(step->text), "%s", arg);
+    return true;
+  }
+
+  if (word && strcmp(word, "touch") == 0 && !arg)
+  {
+    step->kind = STEP_TOUCH;
+  }
+  else if (word && strcmp(word, "untouch") == 0 && !arg)
+  {
+    step->kind = STEP_UNTOUCH;
+  }
+  else if (word && (strcmp(word, "press") == 0 || strcmp(word, "release") == 0))
+  {
+    const scenariopin* pin = FindPin(g_inputs, sizeof(g_inputs) / sizeof(g_inputs[0]), arg);
+    if (!pin)
+      return false;
+
+    step->kind = STEP_INPUT;
+    step->pin = pin->pin;
+    step->level = strcmp(word, "press") == 0 ? LOW : HIGH;
+  }
+  else if (word && strcmp(word, "mains") == 0 && arg && (strcmp(arg, "lost") == 0 || strcmp(arg, "restored") == 0))
+  {
+    step->kind = STEP_INPUT;
+    step->pin = PIN_MAINS_POWER;
+    step->level = strcmp(arg, "lost") == 0 ? LOW : HIGH;
+  }
+  else
+  {
+    return false;
+  }
+
+  snprintf(step->text, sizeof(step->text), "%s%s%s", word, arg ? " " : "", arg ? arg : "");
+  return true;
+}
+
+static bool ParseExpect(char* rest, scenarioexpect* e)
+{
+  char* word = NextWord(&rest);
+  if (!ParseNumber(word, &e->from))
+    return false;
+
+  //the text of a serial expect may have spaces, within is the last word but one
+  char* within = NULL;
+  for (char* p = strstr(rest, " within "); p; p = strstr(p + 1, " within "))
+    within = p;
+  if (!within)
+    return false;
+
+  *within = 0;
+  within += strlen(" within ");
+  if (!ParseNumber(within, &e->within))
+    return false;
+
+  word = NextWord(&rest);
+  if (word && strcmp(word, "serial") == 0)
+  {
+    if (!*rest)
+      return false;
+
+    e->kind = EXPECT_SERIAL;
+    snprintf(e->text, sizeof(e->text), "%s", rest);
+    return true;
+  }
+
+  const scenariopin* pin = FindPin(g_outputs, sizeof(g_outputs) / sizeof(g_outputs[0]), word);
+  char* level = NextWord(&rest);
+  if (!pin || !level || *rest)
+    return false;
+
+  if (strcmp(level, "high") == 0)
+    e->level = HIGH;
+  else if (strcmp(level, "low") == 0)
+    e->level = LOW;
+  else
+    return false;
+
+  e->kind = EXPECT_PIN;
+  e->pin = pin->pin;
+  snprintf(e->text, sizeof(e->text), "%s %s", pin->name, level);
+  return true;
+}
+
+bool ScenarioLoad(const char* path, SimDS1961* button)
+{
+  FILE* file = fopen(path, "r");
+  if (!file)
+  {
+    fprintf(stderr, "can't open %s\n", path);
+    return false;
+  }
+
+  g_button = button;
+  g_end = 0;
+
+  char line[SCENARIO_LINESIZE];
+  uint16_t lineno = 0;
+  const char* error = NULL;
+  while (!error && fgets(line, sizeof(line), file))
+  {
+    lineno++;
+    line[strcspn(line, "#\r\n")] = 0;
+
+    char* rest = line;
+    char* word = NextWord(&rest);
+    if (!word)
+      continue;
+
+    if (strcmp(word, "at") == 0)
+    {
+      if (g_stepcount == SCENARIO_MAXSTEPS)
+      {
+        error = "too many steps";
+        break;
+      }
+
+      scenariostep* step = &g_steps[g_stepcount];
+      if (!ParseNumber(NextWord(&rest), &step->at) || !ParseStep(rest, step))
+        error = "bad step";
+      else if (g_stepcount > 0 && step->at < g_steps[g_stepcount - 1].at)
+        error = "steps must be in order of time";
+      else if ((step->kind == STEP_TOUCH || step->kind == STEP_UNTOUCH) && !g_button)
+        error = "touch needs --button";
+      else
+        g_stepcount++;
+    }
+    else if (strcmp(word, "expect") == 0)
+    {
+      if (g_expectcount == SCENARIO_MAXEXPECTS)
+        error = "too many expects";
+      else if (!ParseExpect(rest, &g_expects[g_expectcount]))
+        error = "bad expect";
+      else
+        g_expectcount++;
+    }
+    else if (strcmp(word, "run") == 0)
+    {
+      if (!ParseNumber(NextWord(&rest), &g_end) || *rest)
+        error = "bad run";
+    }
+    else if (strcmp(word, "trace") == 0)
+    {
+      word = NextWord(&rest);
+      if (!word || strcmp(word, "leds") != 0 || *rest)
+        error = "bad trace";
+      g_traceleds = true;
+    }
+    else
+    {
+      error = "unknown step";
+    }
+  }
+  fclose(file);
+
+  if (error)
+  {
+    fprintf(stderr, "%s:%u: %s\n", path, lineno, error);
+    return false;
+  }
+
+  if (g_end == 0)
+    g_end = (g_stepcount ? g_steps[g_stepcount - 1].at : 0) + SCENARIO_TAIL;
+
+  //the button only touches the reader when the scenario says so
+  if (g_button)
+    g_button->SetPresent(false);
+
+  SimSetSerialOutput(SerialOut);
+  SimSetPinWatch(PinChanged);
+
+  return true;
+}
+
+// runs from the alarm of the simulated clock, so a step lands at its time
+// even while the firmware waits in a delay() or on a bus
+static void ApplySteps()
+{
+  for (; g_nextstep < g_stepcount; g_nextstep++)
+  {
+    const scenariostep* step = &g_steps[g_nextstep];
+    if ((uint64_t)step->at * 1000 > SimMicros())
+    {
+      SimSetAlarm((uint64_t)step->at * 1000, ApplySteps);
+      return;
+    }
+
+    PrintTime(SimMicros());
+    printf("> %s%s\n", step->kind == STEP_SERIAL ? "serial " : "", step->text);
+
+    if (step->kind == STEP_SERIAL)
+    {
+      //like the host, an empty line first
+      SimSerialInput("\n", 1);
+      SimSerialInput(step->text, strlen(step->text));
+      SimSerialInput("\n", 1);
+    }
+    else if (step->kind == STEP_TOUCH)
+    {
+      g_button->SetPresent(true);
+    }
+    else if (step->kind == STEP_UNTOUCH)
+    {
+      g_button->SetPresent(false);
+    }
+    else if (step->kind == STEP_INPUT)
+    {
+      SimSetInput(step->pin, step->level);
+    }
+  }
+}
+
+bool ScenarioRun(scenariorunfunc runfor)
+{
+  ApplySteps();
+
+  uint32_t now = SimMicros() / 1000;
+  if (g_end > now)
+    runfor(g_end - now);
+
+  bool ok = true;
+  for (uint16_t i = 0; i < g_expectcount; i++)
+  {
+    const scenarioexpect* e = &g_expects[i];
+    printf("expect %u %s%s within %u: ", e->from, e->kind == EXPECT_SERIAL ? "serial " : "", e->text, e->within);
+
+    uint64_t took = e->at - (uint64_t)e->from * 1000;
+    if (!e->met)
+    {
+      printf("not seen FAIL\n");
+      ok = false;
+    }
+    else if (took > (uint64_t)e->within * 1000)
+    {
+      printf("%llu.%03llu ms FAIL\n", (unsigned long long)(took / 1000), (unsigned long long)(took % 1000));
+      ok = false;
+    }
+    else
+    {
+      printf("%llu.%03llu ms ok\n", (unsigned long long)(took / 1000), (unsigned long long)(took % 1000));
+    }
+  }
+
+  if (g_missingevent != 0)
+  {
+    printf("events %lu to %lu: %lu missing FAIL\n", g_firstevent, g_lastevent, g_missingevent);
+    ok = false;
+  }
+  else if (g_firstevent != 0)
+  {
+    printf("events %lu to %lu: none missing ok\n", g_firstevent, g_lastevent);
+  }
+
+  return ok;
+}
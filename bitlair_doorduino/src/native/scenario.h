@@ -0,0 +1,45 @@
+#ifndef _SCENARIO_H_
+#define _SCENARIO_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ds1961sim.h"
+
+// A timeline for the host build, one step per line, times in ms of virtual
+// time since boot, # starts a comment:
+//
+//   at <ms> serial <command>     the host sends an empty line and the command
+//   at <ms> touch                the --button touches the outer reader
+//   at <ms> untouch
+//   at <ms> press <input>        hornbutton, openbutton or doordone
+//   at <ms> release <input>
+//   at <ms> mains lost|restored
+//   run <ms>                     how long to run, a second past the last step
+//                                if not given
+//   trace leds                   adds the LEDs to the timeline
+//   expect <ms> <pin> high|low within <ms>
+//   expect <ms> serial <text> within <ms>
+//
+// The outputs are close, open, doorpower, solenoid, horn, ledsolenoid,
+// ledhorn, ledgreen and ledred. An expect is met by the first change of the
+// pin to that level, or the first serial line holding the text, at or after
+// its time. For ledgreen and ledred high is full brightness.
+//
+// The firmware runs with loop() against the virtual clock. The steps are
+// taken at their time on that clock, also while the firmware waits, and a
+// press or release reaches the inputs through their pin change interrupt
+// right then. Every serial line and change of an output is printed with its
+// time, then every expect with the time it took. The event lines must come
+// in order of seq, see events.h, one that was skipped fails the scenario.
+
+// reads the scenario and starts watching the serial port and the pins, call
+// it before setup() so nothing is missed, button may be NULL
+bool ScenarioLoad(const char* path, SimDS1961* button);
+
+// runs the steps, runfor runs the firmware for that many ms, returns false
+// when an expect wasn't met in time
+typedef void (*scenariorunfunc)(uint32_t ms);
+bool ScenarioRun(scenariorunfunc runfor);
+
+#endif /* _SCENARIO_H_ */
@@ -0,0 +1,424 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "Arduino.h"
+#include "sim.h"
+
+#define SERIAL_RXSIZE          4096
+#define SERIAL_TXROOM          63    // what the AVR core reports with an empty buffer
+
+#define TWI_ADDRESSES          128
+
+struct simpin
+{
+  uint8_t        mode;
+  uint8_t        output;    // driven level, or the PWM value
+  uint8_t        input;     // level when nothing drives it
+  bool           masterlow; // the firmware pulls the pin low
+  bool           pinchange; // the pin change interrupt is enabled
+  SimWireDevice* wire;
+};
+
+static uint64_t    g_now;        // us
+static uint32_t    g_lasttick;   // ms
+static bool        g_interrupts = true;
+static bool        g_inticks;
+static simtickfunc g_tick;
+
+static uint64_t     g_alarmat;   // us
+static simalarmfunc g_alarm;
+
+static simpinchangefunc g_pinchange;
+static bool             g_pinchangepending;
+
+static simpin g_pins[SIM_PINS];
+static bool   g_pinsinit;
+
+static char          g_rx[SERIAL_RXSIZE];
+static size_t        g_rxhead;
+static size_t        g_rxtail;
+static simserialfunc g_serialout;
+static uint32_t      g_txbyteus;   // the time a byte takes on the line
+static uint64_t      g_txdone;     // when the last byte written is out
+static simpinfunc    g_pinwatch;
+
+static SimTwiDevice* g_twi[TWI_ADDRESSES];
+
+HardwareSerial Serial;
+
+static void InitPins()
+{
+  if (g_pinsinit)
+    return;
+
+  for (uint8_t i = 0; i < SIM_PINS; i++)
+  {
+    g_pins[i].mode = INPUT;
+    g_pins[i].input = HIGH;
+  }
+  g_pinsinit = true;
+}
+
+// runs the tick for every ms boundary the clock passed, and a pin change
+// that is pending, unless interrupts are off, then it catches up when
+// they're turned on again
+static void RunTicks()
+{
+  if (!g_interrupts || g_inticks)
+    return;
+
+  if (g_pinchangepending)
+  {
+    g_pinchangepending = false;
+    g_interrupts = false;
+    g_pinchange();
+    g_interrupts = true;
+  }
+
+  g_inticks = true;
+  while (g_now / 1000 > g_lasttick)
+  {
+    g_lasttick++;
+    if (g_tick)
+    {
+      g_interrupts = false;
+      g_tick(g_lasttick);
+      g_interrupts = true;
+    }
+  }
+  g_inticks = false;
+}
+
+void SimSetTick(simtickfunc func)
+{
+  g_tick = func;
+}
+
+uint64_t SimMicros()
+{
+  return g_now;
+}
+
+void SimAdvance(uint32_t us)
+{
+  uint64_t end = g_now + us;
+  while (g_alarm && g_alarmat <= end)
+  {
+    if (g_alarmat > g_now)
+    {
+      g_now = g_alarmat;
+      RunTicks();
+    }
+
+    simalarmfunc func = g_alarm;
+    g_alarm = NULL;
+    func();
+  }
+
+  g_now = end;
+  RunTicks();
+}
+
+void SimSetAlarm(uint64_t at, simalarmfunc func)
+{
+  g_alarmat = at;
+  g_alarm = func;
+}
+
+void SimSetPinChange(simpinchangefunc func)
+{
+  g_pinchange = func;
+}
+
+void SimPinChangeEnable(uint8_t pin, bool enable)
+{
+  InitPins();
+  if (pin < SIM_PINS)
+    g_pins[pin].pinchange = enable;
+}
+
+void SimSetInput(uint8_t pin, uint8_t level)
+{
+  InitPins();
+  simpin* p = &g_pins[pin];
+  bool changed = p->input != level && p->mode != OUTPUT;
+  p->input = level;
+
+  if (changed && p->pinchange && g_pinchange)
+  {
+    g_pinchangepending = true;
+    RunTicks();
+  }
+}
+
+int SimGetOutput(uint8_t pin)
+{
+  InitPins();
+  return g_pins[pin].output;
+}
+
+void SimSetPinWatch(simpinfunc func)
+{
+  g_pinwatch = func;
+}
+
+static void SetOutput(uint8_t pin, uint8_t value)
+{
+  if (g_pins[pin].output == value)
+    return;
+
+  g_pins[pin].output = value;
+  if (g_pinwatch)
+    g_pinwatch(pin, value);
+}
+
+void SimSerialInput(const char* data, size_t len)
+{
+  for (size_t i = 0; i < len; i++)
+  {
+    size_t next = (g_rxhead + 1) % SERIAL_RXSIZE;
+    if (next == g_rxtail)
+      break;
+
+    g_rx[g_rxhead] = data[i];
+    g_rxhead = next;
+  }
+}
+
+size_t SimSerialPending()
+{
+  return (g_rxhead + SERIAL_RXSIZE - g_rxtail) % SERIAL_RXSIZE;
+}
+
+void SimSetSerialOutput(simserialfunc func)
+{
+  g_serialout = func;
+}
+
+void SimAttachWire(uint8_t pin, SimWireDevice* device)
+{
+  InitPins();
+  g_pins[pin].wire = device;
+}
+
+void SimAttachTwi(uint8_t address, SimTwiDevice* device)
+{
+  g_twi[address & (TWI_ADDRESSES - 1)] = device;
+}
+
+// bits on the bus, a byte is 9 with its acknowledge, start and stop count as one
+uint32_t SimTwiMicros(uint8_t txlen, uint8_t rxlen, uint8_t result)
+{
+  uint32_t bits = 2 + 9;
+  if (result != SIM_TWI_ADDRNACK)
+  {
+    bits += 9 * txlen;
+    if (rxlen != 0)
+      bits += 1 + 9 + 9 * rxlen;
+  }
+
+  return bits * 1000000L / SIM_TWI_FREQ;
+}
+
+uint8_t SimTwiTransfer(uint8_t address, const uint8_t* tx, uint8_t txlen, uint8_t* rx, uint8_t rxlen)
+{
+  SimTwiDevice* device = g_twi[address & (TWI_ADDRESSES - 1)];
+  uint8_t result = device ? device->Transfer(tx, txlen, rx, rxlen, g_now) : SIM_TWI_ADDRNACK;
+
+  SimAdvance(SimTwiMicros(txlen, rxlen, result));
+
+  return result;
+}
+
+// the line of a 1-Wire pin is low when either side pulls it low
+static void UpdateMaster(uint8_t pin)
+{
+  simpin* p = &g_pins[pin];
+  bool low = p->mode == OUTPUT && p->output == LOW;
+  if (low == p->masterlow)
+    return;
+
+  p->masterlow = low;
+  if (p->wire)
+    p->wire->MasterEdge(low, g_now);
+}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+  InitPins();
+  if (pin >= SIM_PINS)
+    return;
+
+  if (mode == INPUT_PULLUP)
+  {
+    g_pins[pin].mode = INPUT;
+    g_pins[pin].output = HIGH;
+  }
+  else
+  {
+    g_pins[pin].mode = mode;
+  }
+
+  UpdateMaster(pin);
+}
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+  InitPins();
+  if (pin >= SIM_PINS)
+    return;
+
+  SetOutput(pin, value ? HIGH : LOW);
+  UpdateMaster(pin);
+}
+
+int digitalRead(uint8_t pin)
+{
+  InitPins();
+  if (pin >= SIM_PINS)
+    return LOW;
+
+  simpin* p = &g_pins[pin];
+  if (p->wire)
+    return p->masterlow || p->wire->HoldsLow(g_now) ? LOW : HIGH;
+
+  if (p->mode == OUTPUT)
+    return p->output;
+
+  return p->input;
+}
+
+void analogWrite(uint8_t pin, int value)
+{
+  InitPins();
+  if (pin >= SIM_PINS)
+    return;
+
+  g_pins[pin].mode = OUTPUT;
+  SetOutput(pin, value);
+}
+
+uint32_t millis()
+{
+  return g_now / 1000;
+}
+
+uint32_t micros()
+{
+  return g_now;
+}
+
+void delay(uint32_t ms)
+{
+  SimAdvance(ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+  SimAdvance(us);
+}
+
+void yield()
+{
+  SimAdvance(SIM_YIELD_US);
+}
+
+void noInterrupts()
+{
+  g_interrupts = false;
+}
+
+void interrupts()
+{
+  g_interrupts = true;
+  RunTicks();
+}
+
+void HardwareSerial::begin(unsigned long baud)
+{
+  //a start bit, 8 data bits and a stop bit
+  g_txbyteus = 10 * 1000000UL / baud;
+}
+
+// bytes written that aren't out yet
+static int TxPending()
+{
+  if (g_txbyteus == 0 || g_txdone <= g_now)
+    return 0;
+
+  return (g_txdone - g_now + g_txbyteus - 1) / g_txbyteus;
+}
+
+int HardwareSerial::available()
+{
+  return SimSerialPending();
+}
+
+int HardwareSerial::read()
+{
+  if (g_rxtail == g_rxhead)
+    return -1;
+
+  uint8_t c = g_rx[g_rxtail];
+  g_rxtail = (g_rxtail + 1) % SERIAL_RXSIZE;
+  return c;
+}
+
+int HardwareSerial::availableForWrite()
+{
+  int pending = TxPending();
+  return pending < SERIAL_TXROOM ? SERIAL_TXROOM - pending : 0;
+}
+
+size_t HardwareSerial::write(uint8_t c)
+{
+  //a full buffer waits for a byte to go out, as on the AVR
+  while (TxPending() >= SERIAL_TXROOM)
+    SimAdvance(g_txbyteus);
+  if (g_txbyteus != 0)
+    g_txdone = (g_txdone > g_now ? g_txdone : g_now) + g_txbyteus;
+
+  if (g_serialout)
+    g_serialout(c);
+  else
+    putchar(c);
+
+  return 1;
+}
+
+size_t HardwareSerial::write(const uint8_t* buf, size_t len)
+{
+  for (size_t i = 0; i < len; i++)
+    write(buf[i]);
+
+  return len;
+}
+
+size_t HardwareSerial::print(const char* str)
+{
+  return write((const uint8_t*)str, strlen(str));
+}
+
+size_t HardwareSerial::print(long value, int base)
+{
+  char buf[24];
+  snprintf(buf, sizeof(buf), base == HEX ? "%lx" : "%ld", value);
+  return print(buf);
+}
+
+size_t HardwareSerial::println(const char* str)
+{
+  return print(str) + print("\r\n");
+}
+
+size_t HardwareSerial::println(long value, int base)
+{
+  return print(value, base) + print("\r\n");
+}
+
+void HardwareSerial::flush()
+{
+  fflush(stdout);
+}
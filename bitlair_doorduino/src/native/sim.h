@@ -0,0 +1,95 @@
+#ifndef _SIM_H_
+#define _SIM_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// The simulated hardware of the host build. The firmware reaches it through
+// the Arduino API in Arduino.h, the pin macros of OneWire and the host branch
+// of twi.cpp, so none of its modules know they're not on a Nano.
+//
+// Virtual time only moves in delay(), delayMicroseconds(), yield(), bus
+// transfers and SimAdvance(), so the same input always gives the same run.
+
+#define SIM_PINS               22
+#define SIM_TWI_FREQ           100000L
+#define SIM_YIELD_US           10    // what a pass through a busy wait costs
+
+// called for every ms of virtual time, with interrupts enabled, in place of
+// the timer interrupts
+typedef void (*simtickfunc)(uint32_t ms);
+void     SimSetTick(simtickfunc func);
+
+uint64_t SimMicros();
+void     SimAdvance(uint32_t us);
+
+// calls func once when the clock reaches at (us), from whatever moves it on,
+// so also halfway a delay() or a bus transfer, a new alarm replaces the last
+typedef void (*simalarmfunc)();
+void     SimSetAlarm(uint64_t at, simalarmfunc func);
+
+// the level an input reads while nothing drives it, HIGH by default like a
+// pulled up pin
+void     SimSetInput(uint8_t pin, uint8_t level);
+// the pin change interrupt, func runs when an input with it enabled changes
+// level, right away, or once interrupts are enabled again
+typedef void (*simpinchangefunc)();
+void     SimSetPinChange(simpinchangefunc func);
+void     SimPinChangeEnable(uint8_t pin, bool enable);
+// the level the firmware drives, or the last analogWrite() value
+int      SimGetOutput(uint8_t pin);
+
+// called whenever the firmware changes what it drives on a pin, with the
+// level or the analogWrite() value
+typedef void (*simpinfunc)(uint8_t pin, int value);
+void     SimSetPinWatch(simpinfunc func);
+
+// Serial, what the firmware writes goes to func, stdout by default. It goes
+// out at the rate of begin(), with a TX buffer as big as the AVR core's,
+// that a write waits on when it's full.
+typedef void (*simserialfunc)(uint8_t c);
+void     SimSerialInput(const char* data, size_t len);
+size_t   SimSerialPending();
+void     SimSetSerialOutput(simserialfunc func);
+
+// a device on a 1-Wire pin, it sees the master pull the line low and let go,
+// and can hold the line low itself
+class SimWireDevice
+{
+public:
+  virtual ~SimWireDevice() {}
+  virtual void MasterEdge(bool low, uint64_t now) = 0;
+  virtual bool HoldsLow(uint64_t now) = 0;
+};
+
+void     SimAttachWire(uint8_t pin, SimWireDevice* device);
+
+// a device on the TWI bus, Transfer() returns one of the SIM_TWI_* results
+#define SIM_TWI_ACK            0
+#define SIM_TWI_ADDRNACK       1
+#define SIM_TWI_DATANACK       2
+
+class SimTwiDevice
+{
+public:
+  virtual ~SimTwiDevice() {}
+  virtual uint8_t Transfer(const uint8_t* tx, uint8_t txlen, uint8_t* rx, uint8_t rxlen, uint64_t now) = 0;
+};
+
+void     SimAttachTwi(uint8_t address, SimTwiDevice* device);
+
+// runs one transfer, moving the clock on by the time it takes on the bus
+uint8_t  SimTwiTransfer(uint8_t address, const uint8_t* tx, uint8_t txlen, uint8_t* rx, uint8_t rxlen);
+
+// the time a transfer with this result takes on the bus
+uint32_t SimTwiMicros(uint8_t txlen, uint8_t rxlen, uint8_t result);
+
+// feeds one byte of timer jitter to the entropy pool, Entropy.cpp
+void     SimEntropyTick(uint8_t value);
+
+// randomByte() returns these len bytes first, they must stay around until
+// they're used
+void     SimEntropyForce(const uint8_t* data, size_t len);
+
+#endif /* _SIM_H_ */
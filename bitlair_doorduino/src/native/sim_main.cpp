@@ -0,0 +1,390 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Arduino.h"
+#include "sim.h"
+#include "ds1961sim.h"
+#include "eepromsim.h"
+#include "replaysim.h"
+#include "scenario.h"
+#include "../ds1961.h"
+#include "../leds.h"
+#include "../logger.h"
+#include "../scheduler.h"
+
+// Runs the lock on the host. Every line read from stdin goes to the serial
+// port as it is, after which the firmware runs for --line-ms of virtual time,
+// and after the last line for --tail-ms more. Like the real host, send an
+// empty line before every command:
+//
+//   printf '\nlist_buttons\n' | .pio/build/native/program
+//
+// --button puts an emulated DS1961 on the outer reader, touching it from the
+// start, --faults makes it fail permille of its transactions. --bench then
+// runs AuthenticateButton() on it that many times after the last line and
+// prints the virtual time it took on stderr, with a word in the entropy pool
+// for every run as ReaderTask() has, add the button to the store first:
+//
+//   printf '\nadd_button 335634120000006b 0011223344556677\n' |
+//     .pio/build/native/program --button 335634120000006b:0011223344556677 --bench 1000
+//
+// The store is on a 24Cxx model with its page size and write cycle. --eeprom
+// loads its contents from a file and saves them there at the end, --eeprom-stats
+// prints its bus counters. --power-loss n cuts the power halfway write cycle
+// n and ends the run, the next run with the same file boots from what was
+// left, which is how to check that no change to the store leaves it broken:
+//
+//   printf '\nadd_button ...\n' | .pio/build/native/program --eeprom ee.bin --power-loss 1
+//   printf '\nlist_buttons\n' | .pio/build/native/program --eeprom ee.bin
+//
+// --scenario runs a timeline from a file instead of stdin and checks how long
+// the lock took to respond, see scenario.h, it exits with 1 when it was too
+// late:
+//
+//   .pio/build/native/program --button 335634120000006b:0011223344556677 --scenario open.txt
+//
+// --replay plays the dump of the capture command back on both readers, see
+// capture.h, once the lines on stdin ran, so they can put the button in the
+// store first. The firmware draws the challenges of the dump again, those of
+// the outer reader first, and it prints what the readers made of it:
+//
+//   printf '\nadd_button 335634120000006b 0011223344556677\n' |
+//     .pio/build/native/program --replay capture.log
+
+#define LOOP_US                20    // a pass of loop() that ran something
+#define ENTROPY_INTERVAL       16    // ms between watchdog interrupts
+#define EEPROM_ADDRESS         0x50
+#define EEPROM_SIZE            2048
+#define EEPROM_PAGESIZE        16
+#define PIN_1WIRE              8     // the outer reader, as in main.cpp
+#define PIN_1WIRE_INNER        12
+#define REPLAY_STEPMS          100
+#define REPLAY_MAXMS           600000 // stop waiting for the readers to finish a replay
+#define REPLAY_CHALLENGES      256
+
+void setup();
+void loop();
+bool AuthenticateButton(DS1961* ibutton, uint8_t* addr);
+
+extern DS1961 ibutton;
+extern DS1961 ibuttoninner;
+
+static SimEeprom  g_eeprom(EEPROM_SIZE, EEPROM_PAGESIZE);
+static SimDS1961* g_button;
+static SimReplay  g_replayouter(PIN_1WIRE);
+static SimReplay  g_replayinner(PIN_1WIRE_INNER);
+static uint8_t    g_challenges[REPLAY_CHALLENGES * 4];
+static uint8_t    g_buttonid[8];
+static uint8_t    g_benchnonce[4]; // the nonce and the delay byte of one authentication
+static uint32_t   g_seed = 1;
+
+// xorshift32, the timer jitter of the watchdog interrupt
+static uint8_t Jitter()
+{
+  g_seed ^= g_seed << 13;
+  g_seed ^= g_seed >> 17;
+  g_seed ^= g_seed << 5;
+  return g_seed;
+}
+
+// what the timer 0 and watchdog interrupts do on the Nano
+static void Tick(uint32_t ms)
+{
+  LEDTick();
+
+  if (ms % ENTROPY_INTERVAL == 0)
+    SimEntropyTick(Jitter());
+}
+
+static void RunFor(uint32_t ms)
+{
+  uint64_t end = SimMicros() + (uint64_t)ms * 1000;
+  while (SimMicros() < end && !g_eeprom.PowerLost())
+  {
+    loop();
+
+    //nothing can happen before the next timer tick
+    if (TaskAnyDue())
+      SimAdvance(LOOP_US);
+    else
+      SimAdvance(1000 - SimMicros() % 1000);
+  }
+}
+
+// authenticates the emulated button count times in a row, a failure is a
+// wrong MAC or a read that failed on every retry
+static void Bench(uint32_t count)
+{
+  uint32_t ok = 0;
+  uint64_t total = 0;
+  uint64_t min = UINT64_MAX;
+  uint64_t max = 0;
+
+  ibutton.ResetStats();
+  g_button->ResetStats();
+
+  for (uint32_t i = 0; i < count; i++)
+  {
+    //ReaderTask only scans with a word in the pool, so the nonce never waits
+    //for the watchdog there, nor should it here
+    for (uint8_t j = 0; j < sizeof(g_benchnonce); j++)
+      g_benchnonce[j] = Jitter();
+    SimEntropyForce(g_benchnonce, sizeof(g_benchnonce));
+
+    uint64_t start = SimMicros();
+    if (AuthenticateButton(&ibutton, g_buttonid))
+      ok++;
+
+    uint64_t us = SimMicros() - start;
+    total += us;
+    if (us < min)
+      min = us;
+    if (us > max)
+      max = us;
+
+    //what it logged goes out between the runs, not in them
+    LogFlush();
+  }
+  fflush(stdout);
+
+  ds1961stats reader;
+  simds1961stats button;
+  ibutton.GetStats(&reader);
+  g_button->GetStats(&button);
+
+  //on stderr, apart from the serial port
+  fprintf(stderr, "bench auth %u ok %u failed %u us min %llu avg %llu max %llu per_s %.1f\n",
+                  count, ok, count - ok, (unsigned long long)(count ? min : 0),
+                  (unsigned long long)(count ? total / count : 0), (unsigned long long)max,
+                  total ? ok * 1e6 / total : 0.0);
+  fprintf(stderr, "bench reader presence %u crc %u status %u retries %u failures %u\n",
+                  reader.presence, reader.crc, reader.status, reader.retries, reader.failures);
+  fprintf(stderr, "bench button resets %u selects %u authreads %u faults %u\n",
+                  button.resets, button.selects, button.authreads, button.faults);
+}
+
+static void PrintReplay(SimReplay* replay, DS1961* reader, uint8_t pin)
+{
+  simreplaystats stats;
+  replay->GetStats(&stats);
+  printf("replay pin %u transactions %u of %u resets %u mismatches %u skipped %u extra %u\n",
+         pin, stats.transactions, replay->GetTransactions(), stats.resets, stats.mismatches, stats.skipped,
+         stats.extra);
+
+  ds1961stats bus;
+  reader->GetStats(&bus);
+  printf("replay reader %u presence %u crc %u status %u retries %u failures %u\n",
+         pin, bus.presence, bus.crc, bus.status, bus.retries, bus.failures);
+}
+
+static bool ParseHex(const char* str, uint8_t* data, uint8_t len)
+{
+  for (uint8_t i = 0; i < len; i++)
+  {
+    unsigned int value;
+    if (sscanf(str + i * 2, "%2x", &value) != 1)
+      return false;
+    data[i] = value;
+  }
+
+  return true;
+}
+
+static void Usage(const char* name)
+{
+  fprintf(stderr, "usage: %s [--seed n] [--line-ms n] [--tail-ms n] [--button id:secret]\n"
+                  "          [--faults permille] [--bench n] [--eeprom file] [--eeprom-stats]\n"
+                  "          [--power-loss n] [--scenario file] [--replay file] < commands\n", name);
+  exit(1);
+}
+
+int main(int argc, char** argv)
+{
+  uint32_t linems = 200;
+  uint32_t tailms = 1000;
+  uint32_t faults = 0;
+  uint32_t bench = 0;
+  uint32_t powerloss = 0;
+  const char* eepromfile = NULL;
+  const char* scenario = NULL;
+  const char* replay = NULL;
+  bool eepromstats = false;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--eeprom-stats") == 0)
+    {
+      eepromstats = true;
+      continue;
+    }
+
+    if (i + 1 >= argc)
+      Usage(argv[0]);
+
+    const char* arg = argv[i + 1];
+    uint32_t value = strtoul(arg, NULL, 0);
+    if (strcmp(argv[i], "--seed") == 0)
+    {
+      g_seed = value ? value : 1;
+    }
+    else if (strcmp(argv[i], "--line-ms") == 0)
+    {
+      linems = value;
+    }
+    else if (strcmp(argv[i], "--tail-ms") == 0)
+    {
+      tailms = value;
+    }
+    else if (strcmp(argv[i], "--button") == 0)
+    {
+      uint8_t secret[8];
+      if (strlen(arg) != 33 || arg[16] != ':' || !ParseHex(arg, g_buttonid, 8) || !ParseHex(arg + 17, secret, 8))
+        Usage(argv[0]);
+      if (OneWire::crc8(g_buttonid, 7) != g_buttonid[7])
+        fprintf(stderr, "the CRC of id %.16s is wrong, the readers will ignore it\n", arg);
+      g_button = new SimDS1961(g_buttonid, secret);
+    }
+    else if (strcmp(argv[i], "--faults") == 0)
+    {
+      faults = value;
+    }
+    else if (strcmp(argv[i], "--bench") == 0)
+    {
+      bench = value;
+    }
+    else if (strcmp(argv[i], "--eeprom") == 0)
+    {
+      eepromfile = arg;
+    }
+    else if (strcmp(argv[i], "--power-loss") == 0)
+    {
+      powerloss = value;
+    }
+    else if (strcmp(argv[i], "--scenario") == 0)
+    {
+      scenario = arg;
+    }
+    else if (strcmp(argv[i], "--replay") == 0)
+    {
+      replay = arg;
+    }
+    else
+    {
+      Usage(argv[0]);
+    }
+
+    i++;
+  }
+
+  SimSetTick(Tick);
+  //a file that isn't there yet is an erased EEPROM
+  if (eepromfile)
+    g_eeprom.Load(eepromfile);
+  g_eeprom.SetPowerLoss(powerloss, g_seed);
+  SimAttachTwi(EEPROM_ADDRESS, &g_eeprom);
+  if (g_button)
+  {
+    g_button->SetFaults(faults, SIMDS1961_FAULT_ALL, g_seed);
+    SimAttachWire(PIN_1WIRE, g_button);
+  }
+  else if (bench)
+  {
+    Usage(argv[0]);
+  }
+
+  //the replay takes the place of the button
+  if (replay && (g_button || scenario))
+    Usage(argv[0]);
+  if (replay && (!g_replayouter.Load(replay) || !g_replayinner.Load(replay)))
+  {
+    fprintf(stderr, "can't read %s\n", replay);
+    return 1;
+  }
+
+  if (scenario && !ScenarioLoad(scenario, g_button))
+    return 1;
+
+  setup();
+
+  bool ok = true;
+  if (scenario)
+  {
+    ok = ScenarioRun(RunFor);
+  }
+  else
+  {
+    char line[256];
+    while (fgets(line, sizeof(line), stdin))
+    {
+      SimSerialInput(line, strlen(line));
+      RunFor(linems);
+      if (g_eeprom.PowerLost())
+        break;
+    }
+
+    if (replay && !g_eeprom.PowerLost())
+    {
+      SimAttachWire(PIN_1WIRE, &g_replayouter);
+      SimAttachWire(PIN_1WIRE_INNER, &g_replayinner);
+      ibutton.ResetStats();
+      ibuttoninner.ResetStats();
+
+      uint32_t len = g_replayouter.GetChallenges(g_challenges, REPLAY_CHALLENGES * 3);
+      len += g_replayinner.GetChallenges(g_challenges + len, REPLAY_CHALLENGES * 3 - len);
+
+      //every challenge is followed by the byte of the random delay
+      for (uint32_t i = len / 3; i-- > 0;)
+      {
+        memmove(g_challenges + i * 4, g_challenges + i * 3, 3);
+        g_challenges[i * 4 + 3] = 0;
+      }
+      SimEntropyForce(g_challenges, len / 3 * 4);
+
+      uint32_t ms = 0;
+      while ((!g_replayouter.Done() || !g_replayinner.Done()) && ms < REPLAY_MAXMS && !g_eeprom.PowerLost())
+      {
+        RunFor(REPLAY_STEPMS);
+        ms += REPLAY_STEPMS;
+      }
+    }
+
+    if (!g_eeprom.PowerLost())
+      RunFor(tailms);
+  }
+
+  if (replay)
+  {
+    PrintReplay(&g_replayouter, &ibutton, PIN_1WIRE);
+    PrintReplay(&g_replayinner, &ibuttoninner, PIN_1WIRE_INNER);
+  }
+
+  if (bench && !g_eeprom.PowerLost())
+    Bench(bench);
+
+  if (eepromstats)
+  {
+    simeepromstats stats;
+    g_eeprom.GetStats(&stats);
+    printf("eeprom transfers %u nacks %u bytes %u written %u read %u writecycles %u bus_us %llu\n",
+           stats.transfers, stats.nacks, stats.bytes, stats.written, stats.read, stats.writecycles,
+           (unsigned long long)stats.busus);
+  }
+  fflush(stdout);
+
+  if (eepromfile && !g_eeprom.Save(eepromfile))
+  {
+    fprintf(stderr, "can't write %s\n", eepromfile);
+    return 1;
+  }
+
+  if (g_eeprom.PowerLost())
+  {
+    fprintf(stderr, "power lost in write cycle %u at %llu us\n", powerloss, (unsigned long long)SimMicros());
+    return 2;
+  }
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,24 @@
+#ifndef _UTIL_ATOMIC_H_
+#define _UTIL_ATOMIC_H_
+
+#include "Arduino.h"
+
+// ATOMIC_BLOCK() from avr-libc for the host build, it only supports
+// ATOMIC_RESTORESTATE as the simulated interrupts are on outside of a tick
+#define ATOMIC_RESTORESTATE    0
+
+static inline uint8_t AtomicEnter()
+{
+  noInterrupts();
+  return 1;
+}
+
+static inline void AtomicLeave(const uint8_t*)
+{
+  interrupts();
+}
+
+#define ATOMIC_BLOCK(type) \
+  for (uint8_t atomicguard __attribute__((__cleanup__(AtomicLeave))) = AtomicEnter(); atomicguard; atomicguard = 0)
+
+#endif /* _UTIL_ATOMIC_H_ */
@@ -0,0 +1,85 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <Arduino.h>
+#if defined(__AVR__)
+#include <avr/power.h>
+#include <avr/sleep.h>
+#endif
+
+#include "power.h"
+
+#define POWER_SAMPLES          3   // equal samples needed to accept a change
+
+static bool    g_onbattery;
+static uint8_t g_powersamples;
+
+static void SetPeripherals(bool onbattery)
+{
+#if defined(__AVR__)
+  //nothing uses the ADC or SPI, the PWM timers and TWI are still needed
+  if (onbattery)
+  {
+    ADCSRA &= ~_BV(ADEN);
+    power_adc_disable();
+    power_spi_disable();
+  }
+  else
+  {
+    power_spi_enable();
+    power_adc_enable();
+    ADCSRA |= _BV(ADEN);
+  }
+#else
+  (void)onbattery;
+#endif
+}
+
+void PowerInit()
+{
+  pinMode(PIN_MAINS_POWER, INPUT);
+  g_onbattery = digitalRead(PIN_MAINS_POWER) == LOW;
+  g_powersamples = 0;
+  SetPeripherals(g_onbattery);
+}
+
+bool PowerUpdate()
+{
+  bool onbattery = digitalRead(PIN_MAINS_POWER) == LOW;
+  if (onbattery == g_onbattery)
+  {
+    g_powersamples = 0;
+    return false;
+  }
+
+  if (++g_powersamples < POWER_SAMPLES)
+    return false;
+
+  g_powersamples = 0;
+  g_onbattery = onbattery;
+  SetPeripherals(onbattery);
+
+  return true;
+}
+
+bool PowerOnBattery()
+{
+  return g_onbattery;
+}
+
+void PowerIdle()
+{
+#if defined(__AVR__)
+  if (g_onbattery)
+  {
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    sleep_enable();
+    //sei only takes effect after the next instruction, an interrupt that is
+    //already pending wakes the sleep instead of being taken just before it
+    sei();
+    sleep_cpu();
+    sleep_disable();
+  }
+#endif
+  interrupts();
+}
@@ -0,0 +1,26 @@
+#ifndef _POWER_H_
+#define _POWER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Tracks whether the board runs from mains or from the backup battery. On
+// battery the loop puts the MCU in idle sleep whenever no task is due; any
+// interrupt wakes it up again, at the latest the timer 0 tick one ms later.
+
+#define PIN_MAINS_POWER        2
+
+void PowerInit();
+
+// samples the mains sense pin, returns true when the power source changed
+bool PowerUpdate();
+
+bool PowerOnBattery();
+
+// sleeps until the next interrupt, only when on battery. Call it with
+// interrupts off, after checking that no interrupt left work behind, it
+// returns with them on. That way an interrupt between the check and the
+// sleep can't leave the work waiting for the next timer tick.
+void PowerIdle();
+
+#endif /* _POWER_H_ */
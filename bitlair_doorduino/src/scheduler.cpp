@@ -0,0 +1,85 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <Arduino.h>
+
+#include "scheduler.h"
+
+struct task
+{
+  taskfunc func;
+  uint32_t deadline;
+  uint16_t period;
+  bool     active;
+};
+
+static task g_tasks[SCHED_MAXTASKS];
+
+void TaskCreate(uint8_t id, taskfunc func, uint16_t period)
+{
+  g_tasks[id].func = func;
+  g_tasks[id].period = period;
+  g_tasks[id].deadline = millis();
+  g_tasks[id].active = true;
+}
+
+void TaskWakeIn(uint8_t id, uint32_t delayms)
+{
+  g_tasks[id].deadline = millis() + delayms;
+  g_tasks[id].active = true;
+}
+
+void TaskSetPeriod(uint8_t id, uint16_t period)
+{
+  g_tasks[id].period = period;
+}
+
+void TaskStop(uint8_t id)
+{
+  g_tasks[id].active = false;
+}
+
+bool TaskActive(uint8_t id)
+{
+  return g_tasks[id].active;
+}
+
+bool TaskAnyDue()
+{
+  uint32_t now = millis();
+  for (uint8_t i = 0; i < SCHED_MAXTASKS; i++)
+  {
+    if (g_tasks[i].active && g_tasks[i].func && TimeReached(now, g_tasks[i].deadline))
+      return true;
+  }
+
+  return false;
+}
+
+void TaskRunDue()
+{
+  for (uint8_t i = 0; i < SCHED_MAXTASKS; i++)
+  {
+    task* t = &g_tasks[i];
+    if (!t->active || !t->func)
+      continue;
+
+    uint32_t now = millis();
+    if (!TimeReached(now, t->deadline))
+      continue;
+
+    //rearm before running, so the task can override it
+    if (t->period)
+    {
+      t->deadline += t->period;
+      if (TimeReached(now, t->deadline))
+        t->deadline = now + t->period; //fell behind, don't try to catch up
+    }
+    else
+    {
+      t->active = false;
+    }
+
+    t->func();
+  }
+}
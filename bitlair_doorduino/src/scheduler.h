@@ -0,0 +1,43 @@
+#ifndef _SCHEDULER_H_
+#define _SCHEDULER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Cooperative scheduler for loop(). Each task is a function that must return
+// quickly; long actions are split into stages that rearm their task with
+// TaskWakeIn() instead of waiting with delay().
+//
+// A task with a period runs again every period ms, a task without one runs
+// once when its deadline passes and stays inactive until it is woken again.
+
+#ifndef SCHED_MAXTASKS
+#define SCHED_MAXTASKS         10
+#endif
+
+typedef void (*taskfunc)();
+
+// true once now is at or past deadline, also across the millis() wraparound
+// as long as the two are less than 2^31 ms apart
+inline bool TimeReached(uint32_t now, uint32_t deadline)
+{
+  return (int32_t)(now - deadline) >= 0;
+}
+
+// registers a task and makes it due right away
+void TaskCreate(uint8_t id, taskfunc func, uint16_t period);
+
+// makes a task due in delayms, activating it if needed
+void TaskWakeIn(uint8_t id, uint32_t delayms);
+
+void TaskSetPeriod(uint8_t id, uint16_t period);
+void TaskStop(uint8_t id);
+bool TaskActive(uint8_t id);
+
+// true if a task is due, so the loop shouldn't sleep
+bool TaskAnyDue();
+
+// runs every task that is due, call this from loop()
+void TaskRunDue();
+
+#endif /* _SCHEDULER_H_ */
@@ -0,0 +1,352 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <Arduino.h>
+
+#include "store.h"
+#include "twi.h"
+#include "events.h"
+#include "logger.h"
+
+#define EEPROMDEVICEADDRESS    0x50
+#define EEPROMSIZE             2048
+#define EEPROMPAGESIZE         16
+
+#define SLOTSIZE               (STORE_ADDRSIZE + STORE_SECRETSIZE)
+#define SLOTS                  (EEPROMSIZE / SLOTSIZE)
+
+#if (STORE_QUEUESIZE & (STORE_QUEUESIZE - 1)) != 0
+#error "STORE_QUEUESIZE must be a power of two"
+#endif
+//a slot is written with one page write
+#if (EEPROMPAGESIZE % SLOTSIZE) != 0
+#error "a slot must not cross an EEPROM page"
+#endif
+
+#define OP_ADD                 0
+#define OP_REMOVE              1
+
+#define PHASE_IDLE             0
+#define PHASE_READ             1   // reading the id in g_slot
+#define PHASE_WRITE            2   // writing g_slot
+
+struct storeop
+{
+  uint8_t op;
+  uint8_t addr[STORE_ADDRSIZE];
+  uint8_t secret[STORE_SECRETSIZE];
+};
+
+static storeop  g_ops[STORE_QUEUESIZE];
+static uint8_t  g_opshead;
+static uint8_t  g_opstail;
+
+static uint8_t     g_phase;
+static uint16_t    g_slot;
+static uint8_t     g_tries;
+static twitransfer g_transfer;
+static uint8_t     g_buf[2 + SLOTSIZE]; // the EEPROM address, then the slot
+
+static storestats g_stats;
+
+static void SetAddress(uint8_t* buf, uint16_t eeaddress)
+{
+  buf[0] = eeaddress >> 8;
+  buf[1] = eeaddress & 0xFF;
+}
+
+// reads len bytes at eeaddress, waiting for the bus
+static bool Read(uint16_t eeaddress, uint8_t* data, uint8_t len)
+{
+  uint8_t header[2];
+  SetAddress(header, eeaddress);
+
+  twitransfer transfer;
+  transfer.device = EEPROMDEVICEADDRESS;
+  transfer.txlen = sizeof(header);
+  transfer.tx = header;
+  transfer.rxlen = len;
+  transfer.rx = data;
+
+  for (uint8_t i = 0; i <= STORE_RETRIES; i++)
+  {
+    if (i > 0)
+      g_stats.retries++;
+
+    while (!TwiQueue(&transfer))
+      TwiProcess();
+
+    if (TwiWait(&transfer) == TWI_DONE)
+      return true;
+  }
+
+  g_stats.failures++;
+  return false;
+}
+
+static void StoreError()
+{
+  LogError("eeprom not responding");
+  EventPost(EVENT_STORE_ERROR);
+}
+
+static bool IsEmpty(const uint8_t* id)
+{
+  for (uint8_t i = 0; i < STORE_ADDRSIZE; i++)
+  {
+    if (id[i] != 0xFF)
+      return false;
+  }
+
+  return true;
+}
+
+// a slot can take a button when every byte of its id is erased or already
+// the same, so a half written slot is reused
+static bool SlotFree(const uint8_t* id, const uint8_t* addr)
+{
+  for (uint8_t i = 0; i < STORE_ADDRSIZE; i++)
+  {
+    if (id[i] != 0xFF && id[i] != addr[i])
+      return false;
+  }
+
+  return true;
+}
+
+static void QueueRead()
+{
+  SetAddress(g_buf, g_slot * SLOTSIZE);
+  g_transfer.txlen = 2;
+  g_transfer.rxlen = STORE_ADDRSIZE;
+  TwiQueue(&g_transfer);
+}
+
+static void QueueWrite(const storeop* op)
+{
+  SetAddress(g_buf, g_slot * SLOTSIZE);
+  if (op->op == OP_ADD)
+  {
+    memcpy(g_buf + 2, op->addr, STORE_ADDRSIZE);
+    memcpy(g_buf + 2 + STORE_ADDRSIZE, op->secret, STORE_SECRETSIZE);
+  }
+  else
+  {
+    memset(g_buf + 2, 0xFF, SLOTSIZE);
+  }
+
+  g_transfer.txlen = 2 + SLOTSIZE;
+  g_transfer.rxlen = 0;
+  g_phase = PHASE_WRITE;
+  TwiQueue(&g_transfer);
+}
+
+static void FinishOp()
+{
+  g_opshead++;
+  g_phase = PHASE_IDLE;
+}
+
+static storeop* QueueOp(uint8_t type)
+{
+  while ((uint8_t)(g_opstail - g_opshead) == STORE_QUEUESIZE)
+    StoreProcess();
+
+  storeop* op = &g_ops[g_opstail & (STORE_QUEUESIZE - 1)];
+  op->op = type;
+  return op;
+}
+
+void StoreInit()
+{
+  TwiInit();
+
+  g_transfer.device = EEPROMDEVICEADDRESS;
+  g_transfer.tx = g_buf;
+  g_transfer.rx = g_buf + 2;
+}
+
+void StoreAdd(const uint8_t* addr, const uint8_t* secret)
+{
+  storeop* op = QueueOp(OP_ADD);
+  memcpy(op->addr, addr, STORE_ADDRSIZE);
+  memcpy(op->secret, secret, STORE_SECRETSIZE);
+  g_opstail++;
+}
+
+void StoreRemove(const uint8_t* addr)
+{
+  storeop* op = QueueOp(OP_REMOVE);
+  memcpy(op->addr, addr, STORE_ADDRSIZE);
+  g_opstail++;
+}
+
+bool StoreBusy()
+{
+  return g_opshead != g_opstail;
+}
+
+// Adding reads slot after slot until one is free and writes it. Removing
+// reads every slot and erases the ones with the id.
+void StoreProcess()
+{
+  TwiProcess();
+
+  if (g_phase == PHASE_IDLE)
+  {
+    if (!StoreBusy())
+      return;
+
+    g_slot = 0;
+    g_tries = 0;
+    g_phase = PHASE_READ;
+    QueueRead();
+    return;
+  }
+
+  uint8_t status = g_transfer.status;
+  if (status == TWI_PENDING)
+    return;
+
+  //the lookups can fill the bus queue, that's no error
+  if (status == TWI_QUEUE_FULL)
+  {
+    TwiQueue(&g_transfer);
+    return;
+  }
+
+  if (status != TWI_DONE)
+  {
+    if (g_tries++ < STORE_RETRIES)
+    {
+      g_stats.retries++;
+      TwiQueue(&g_transfer);
+      return;
+    }
+
+    g_stats.failures++;
+    StoreError();
+    FinishOp();
+    return;
+  }
+
+  g_tries = 0;
+  storeop* op = &g_ops[g_opshead & (STORE_QUEUESIZE - 1)];
+
+  if (g_phase == PHASE_READ)
+  {
+    const uint8_t* id = g_buf + 2;
+    if (op->op == OP_ADD && SlotFree(id, op->addr))
+    {
+      QueueWrite(op);
+      return;
+    }
+    else if (op->op == OP_REMOVE && memcmp(id, op->addr, STORE_ADDRSIZE) == 0)
+    {
+      LogDebug("erasing slot %u", g_slot);
+      QueueWrite(op);
+      return;
+    }
+  }
+  else
+  {
+    //the write cycle is waited for by the next transfer
+    if (op->op == OP_ADD)
+    {
+      LogDebug("stored button in slot %u", g_slot);
+      EventPost(EVENT_BUTTON_ADDED, g_slot);
+      FinishOp();
+      return;
+    }
+
+    EventPost(EVENT_BUTTON_REMOVED, g_slot);
+    g_phase = PHASE_READ;
+  }
+
+  if (++g_slot == SLOTS)
+  {
+    if (op->op == OP_ADD)
+    {
+      LogError("no room in eeprom to store button");
+      EventPost(EVENT_STORE_FULL);
+    }
+
+    FinishOp();
+    return;
+  }
+
+  QueueRead();
+}
+
+// Reads only the CRC byte of every slot, the family code in the first byte
+// is the same for every DS1961S, and the whole slot in one go when the CRC
+// matches.
+bool StoreGetSecret(const uint8_t* addr, uint8_t* secret)
+{
+  if (IsEmpty(addr))
+    return false;
+
+  for (uint16_t i = 0; i < SLOTS; i++)
+  {
+    uint16_t startaddr = i * SLOTSIZE;
+    uint8_t  slot[SLOTSIZE];
+    if (!Read(startaddr + STORE_ADDRSIZE - 1, slot + STORE_ADDRSIZE - 1, 1))
+    {
+      StoreError();
+      return false;
+    }
+
+    if (slot[STORE_ADDRSIZE - 1] != addr[STORE_ADDRSIZE - 1])
+      continue;
+
+    if (!Read(startaddr, slot, SLOTSIZE))
+    {
+      StoreError();
+      return false;
+    }
+
+    if (memcmp(slot, addr, STORE_ADDRSIZE) != 0)
+      continue;
+
+    LogDebug("getting secret from slot %u", i);
+    memcpy(secret, slot + STORE_ADDRSIZE, STORE_SECRETSIZE);
+
+    return true;
+  }
+
+  LogDebug("can't find secret for button");
+
+  return false;
+}
+
+void StoreList()
+{
+  LogAlways("button list start");
+
+  for (uint16_t i = 0; i < SLOTS; i++)
+  {
+    uint8_t id[STORE_ADDRSIZE];
+    if (!Read(i * SLOTSIZE, id, sizeof(id)))
+    {
+      StoreError();
+      return;
+    }
+
+    if (IsEmpty(id))
+      continue;
+
+    char hex[STORE_ADDRSIZE * 2 + 1];
+    LogAlways("button: %s", FormatHex(hex, id, STORE_ADDRSIZE));
+  }
+}
+
+void StoreGetStats(storestats* stats)
+{
+  *stats = g_stats;
+}
+
+void StoreResetStats()
+{
+  memset(&g_stats, 0, sizeof(g_stats));
+}
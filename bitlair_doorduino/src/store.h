@@ -0,0 +1,51 @@
+#ifndef _STORE_H_
+#define _STORE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// The buttons that may open the door, in the external EEPROM. Every slot
+// holds the 8 byte id of a button followed by its 8 byte secret, an erased
+// slot is all 0xFF.
+//
+// Looking up a secret and listing the buttons wait for the bus. Adding and
+// removing a button are queued and done by StoreProcess() a transfer at a
+// time, so the loop keeps reading buttons and inputs during a sync. The
+// result is posted as an event, like before.
+
+#define STORE_ADDRSIZE         8
+#define STORE_SECRETSIZE       8
+
+#ifndef STORE_QUEUESIZE
+#define STORE_QUEUESIZE        2   // must be a power of two
+#endif
+
+// failed transfers are tried this many times more
+#define STORE_RETRIES          2
+
+struct storestats
+{
+  uint16_t retries;
+  uint16_t failures;  // transfers that failed on every try
+};
+
+void StoreInit();
+
+// queue a change, when the queue is full these wait until there's room
+void StoreAdd(const uint8_t* addr, const uint8_t* secret);
+void StoreRemove(const uint8_t* addr);
+
+// true while changes are queued, call StoreProcess() as often as possible
+// until it returns false
+bool StoreBusy();
+void StoreProcess();
+
+bool StoreGetSecret(const uint8_t* addr, uint8_t* secret);
+
+// logs "button list start", then "button: <id>" for every button
+void StoreList();
+
+void StoreGetStats(storestats* stats);
+void StoreResetStats();
+
+#endif /* _STORE_H_ */
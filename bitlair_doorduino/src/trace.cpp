@@ -0,0 +1,220 @@
+#include <stdint.h>
+#include <string.h>
+
+#include <Arduino.h>
+
+#include "trace.h"
+#include "logger.h"
+
+#define TRACE_NAMESIZE         12
+
+struct tracestat
+{
+  uint32_t  min;
+  uint32_t  max;
+  uint32_t  sum;
+  uint16_t  count;
+  histogram hist;
+};
+
+struct latencystat
+{
+  uint16_t  max;      // us
+  histogram hist;
+};
+
+static tracestat g_tracestats[TRACE_COUNT];
+
+static latencystat g_latencystats[LATENCY_COUNT];
+static uint32_t    g_lastloop;
+
+uint8_t g_irqoffstart;
+
+#if defined(TRACE_ISRPIN)
+volatile uint8_t* g_traceisrreg;
+uint8_t           g_traceisrmask;
+#endif
+#if defined(TRACE_PIN)
+static volatile uint8_t* g_tracereg;
+static uint8_t           g_tracemask;
+#endif
+
+static const char g_name_search[]      PROGMEM = "search";
+static const char g_name_lookup[]      PROGMEM = "lookup";
+static const char g_name_nonce[]       PROGMEM = "nonce";
+static const char g_name_challenge[]   PROGMEM = "challenge";
+static const char g_name_mac[]         PROGMEM = "mac";
+static const char g_name_randomdelay[] PROGMEM = "randomdelay";
+static const char g_name_auth[]        PROGMEM = "auth";
+
+static const char g_name_loop[]        PROGMEM = "loop";
+static const char g_name_wdt[]         PROGMEM = "wdt";
+static const char g_name_timer0[]      PROGMEM = "timer0";
+static const char g_name_pcint[]       PROGMEM = "pcint";
+static const char g_name_irqoff[]      PROGMEM = "irqoff";
+static const char g_name_twi[]         PROGMEM = "twi";
+
+static PGM_P const g_latencynames[LATENCY_COUNT] PROGMEM =
+{
+  g_name_loop,
+  g_name_wdt,
+  g_name_timer0,
+  g_name_pcint,
+  g_name_irqoff,
+  g_name_twi,
+};
+
+static PGM_P const g_tracenames[TRACE_COUNT] PROGMEM =
+{
+  g_name_search,
+  g_name_lookup,
+  g_name_nonce,
+  g_name_challenge,
+  g_name_mac,
+  g_name_randomdelay,
+  g_name_auth,
+};
+
+void HistAdd(histogram* hist, uint32_t us)
+{
+  uint8_t bucket = 0;
+  for (uint32_t rest = us >> HIST_FIRSTBITS; rest != 0 && bucket < HIST_BUCKETS - 1; rest >>= 1)
+    bucket++;
+
+  if (hist->bucket[bucket] == 0xFF)
+  {
+    for (uint8_t i = 0; i < HIST_BUCKETS; i++)
+      hist->bucket[i] >>= 1;
+  }
+
+  hist->bucket[bucket]++;
+}
+
+void HistPrint(const histogram* hist, const char* name)
+{
+  const uint8_t* b = hist->bucket;
+  LogAlways("hist %s %u %u %u %u %u %u %u %u %u %u %u %u %u %u", name,
+            b[0], b[1], b[2], b[3], b[4], b[5], b[6], b[7], b[8], b[9], b[10], b[11], b[12], b[13]);
+}
+
+void TraceEnd(uint8_t stage, uint32_t start)
+{
+  uint32_t us = micros() - start;
+  tracestat* stat = &g_tracestats[stage];
+
+  //halve the running sum before it can overflow, the average stays the same
+  if (stat->count == 0xFFFF || stat->sum + us < stat->sum)
+  {
+    stat->count >>= 1;
+    stat->sum >>= 1;
+  }
+
+  if (stat->count == 0 || us < stat->min)
+    stat->min = us;
+  if (us > stat->max)
+    stat->max = us;
+
+  stat->sum += us;
+  stat->count++;
+  HistAdd(&stat->hist, us);
+}
+
+void TracePrint()
+{
+  for (uint8_t i = 0; i < TRACE_COUNT; i++)
+  {
+    const tracestat* stat = &g_tracestats[i];
+
+    char name[TRACE_NAMESIZE];
+    strncpy_P(name, (PGM_P)pgm_read_ptr(&g_tracenames[i]), sizeof(name) - 1);
+    name[sizeof(name) - 1] = 0;
+
+    uint32_t avg = stat->count ? stat->sum / stat->count : 0;
+    LogAlways("stats %s n %u min %lu avg %lu max %lu", name, stat->count,
+              (unsigned long)stat->min, (unsigned long)avg, (unsigned long)stat->max);
+    HistPrint(&stat->hist, name);
+  }
+}
+
+void TraceReset()
+{
+  memset(g_tracestats, 0, sizeof(g_tracestats));
+}
+
+static void LatencyAdd(uint8_t id, uint32_t us)
+{
+  latencystat* stat = &g_latencystats[id];
+  if (us > stat->max)
+    stat->max = us > 0xFFFF ? 0xFFFF : us;
+
+  HistAdd(&stat->hist, us);
+}
+
+void LatencyInit()
+{
+#if defined(TRACE_PIN)
+  pinMode(TRACE_PIN, OUTPUT);
+  g_tracereg = portInputRegister(digitalPinToPort(TRACE_PIN));
+  g_tracemask = digitalPinToBitMask(TRACE_PIN);
+#endif
+#if defined(TRACE_ISRPIN)
+  pinMode(TRACE_ISRPIN, OUTPUT);
+  g_traceisrreg = portOutputRegister(digitalPinToPort(TRACE_ISRPIN));
+  g_traceisrmask = digitalPinToBitMask(TRACE_ISRPIN);
+#endif
+
+  g_lastloop = micros();
+}
+
+void LatencyLoop()
+{
+#if defined(TRACE_PIN)
+  //writing a one to the input register toggles the pin
+  *g_tracereg = g_tracemask;
+#endif
+
+  uint32_t now = micros();
+  LatencyAdd(LATENCY_LOOP, now - g_lastloop);
+  g_lastloop = now;
+}
+
+// called with interrupts disabled
+void LatencyISREnd(uint8_t id, uint8_t start)
+{
+  uint8_t ticks = LATENCY_TICKS() - start;
+  LatencyAdd(id, (uint16_t)ticks * LATENCY_TICKUS);
+  TRACE_ISRPIN_LOW();
+}
+
+void LatencyIrqOnRecord(uint8_t ticks)
+{
+  LatencyAdd(LATENCY_IRQOFF, (uint16_t)ticks * LATENCY_TICKUS);
+}
+
+void LatencyPrint()
+{
+  for (uint8_t i = 0; i < LATENCY_COUNT; i++)
+  {
+    //the handlers update these, print a copy
+    noInterrupts();
+    latencystat stat = g_latencystats[i];
+    interrupts();
+
+    char name[TRACE_NAMESIZE];
+    strncpy_P(name, (PGM_P)pgm_read_ptr(&g_latencynames[i]), sizeof(name) - 1);
+    name[sizeof(name) - 1] = 0;
+
+    LogAlways("latency %s max %u", name, stat.max);
+    HistPrint(&stat.hist, name);
+  }
+}
+
+void LatencyReset()
+{
+  noInterrupts();
+  memset(g_latencystats, 0, sizeof(g_latencystats));
+  interrupts();
+
+  //the pass that printed the stats doesn't count
+  g_lastloop = micros();
+}
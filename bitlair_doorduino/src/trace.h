@@ -0,0 +1,123 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <Arduino.h>
+
+// Timing of the stages between touching the reader and the lock starting to
+// move. Every stage keeps its min, average and max in us plus a histogram, the
+// stats command prints them.
+//
+//   uint32_t start = TraceStart();
+//   ...
+//   TraceEnd(TRACE_LOOKUP, start);
+
+#define TRACE_SEARCH           0   // 1-Wire search that found a button
+#define TRACE_LOOKUP           1   // finding the secret in the EEPROM
+#define TRACE_NONCE            2   // waiting for the watchdog jitter entropy
+#define TRACE_CHALLENGE        3   // writing the challenge and the authenticated page read
+#define TRACE_MAC              4   // computing the expected MAC
+#define TRACE_RANDOMDELAY      5   // includes the entropy for it
+#define TRACE_AUTH             6   // all of AuthenticateButton()
+#define TRACE_COUNT            7
+
+// Log2 histogram of durations in us, the first bucket holds everything below
+// 8 us, the last everything from 32 ms. The counts saturate at 255 by halving
+// all of them, so it keeps the shape rather than the totals.
+#define HIST_BUCKETS           14
+#define HIST_FIRSTBITS         3
+
+struct histogram
+{
+  uint8_t bucket[HIST_BUCKETS];
+};
+
+void HistAdd(histogram* hist, uint32_t us);
+
+// prints one line: "hist <name> <bucket 0> ... <bucket 13>"
+void HistPrint(const histogram* hist, const char* name);
+
+inline uint32_t TraceStart()
+{
+  return micros();
+}
+
+void TraceEnd(uint8_t stage, uint32_t start);
+
+void TracePrint();
+void TraceReset();
+
+// Latency of the loop, the interrupt handlers and the windows with interrupts
+// disabled, always on. Short durations are counted in timer 0 ticks of 4 us,
+// it wraps after 1.024 ms, which is far more than any of them may take.
+//
+// Define TRACE_PIN to toggle that pin on every pass of loop(), and
+// TRACE_ISRPIN to drive that pin high during every timed interrupt handler
+// and interrupts off window, for a logic analyzer.
+
+#define LATENCY_LOOP           0   // from one pass of loop() to the next
+#define LATENCY_WDT            1   // the entropy watchdog handler
+#define LATENCY_TIMER0         2   // the LED handler on the millis() tick
+#define LATENCY_PCINT          3   // the input handler
+#define LATENCY_IRQOFF         4   // interrupts off in OneWire
+#define LATENCY_TWI            5   // the EEPROM bus handler
+#define LATENCY_COUNT          6
+
+#if defined(__AVR__)
+#define LATENCY_TICKS()        TCNT0
+#define LATENCY_TICKUS         4
+#else
+#define LATENCY_TICKS()        ((uint8_t)micros())
+#define LATENCY_TICKUS         1
+#endif
+
+#if defined(TRACE_ISRPIN)
+extern volatile uint8_t* g_traceisrreg;
+extern uint8_t           g_traceisrmask;
+#define TRACE_ISRPIN_HIGH()    (*g_traceisrreg |= g_traceisrmask)
+#define TRACE_ISRPIN_LOW()     (*g_traceisrreg &= ~g_traceisrmask)
+#else
+#define TRACE_ISRPIN_HIGH()
+#define TRACE_ISRPIN_LOW()
+#endif
+
+extern uint8_t g_irqoffstart;
+
+void LatencyInit();
+
+// call at the start of every pass of loop()
+void LatencyLoop();
+
+// call at the start and the end of an interrupt handler
+inline uint8_t LatencyISRStart()
+{
+  TRACE_ISRPIN_HIGH();
+  return LATENCY_TICKS();
+}
+
+void LatencyISREnd(uint8_t id, uint8_t start);
+
+void LatencyIrqOnRecord(uint8_t ticks);
+
+// replace noInterrupts() and interrupts() around a timed window
+inline void LatencyIrqOff()
+{
+  noInterrupts();
+  TRACE_ISRPIN_HIGH();
+  g_irqoffstart = LATENCY_TICKS();
+}
+
+inline void LatencyIrqOn()
+{
+  uint8_t ticks = LATENCY_TICKS() - g_irqoffstart;
+  TRACE_ISRPIN_LOW();
+  interrupts();
+  LatencyIrqOnRecord(ticks);
+}
+
+void LatencyPrint();
+void LatencyReset();
+
+#endif /* _TRACE_H_ */
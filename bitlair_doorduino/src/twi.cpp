@@ -0,0 +1,254 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <Arduino.h>
+#if defined(__AVR__)
+#include <util/twi.h>
+#endif
+
+#include "twi.h"
+#include "trace.h"
+#if defined(NATIVE)
+#include "sim.h"
+#endif
+
+#if (TWI_QUEUESIZE & (TWI_QUEUESIZE - 1)) != 0
+#error "TWI_QUEUESIZE must be a power of two"
+#endif
+
+#if defined(__AVR__)
+// TWINT is cleared by writing a one, which starts the next step
+#define TWCR_NEXT              (_BV(TWEN) | _BV(TWIE) | _BV(TWINT))
+#define TWCR_ACK               (TWCR_NEXT | _BV(TWEA))
+#define TWCR_START             (TWCR_NEXT | _BV(TWSTA))
+#define TWCR_STOP              (TWCR_NEXT | _BV(TWSTO))
+#define TWCR_STOPSTART         (TWCR_NEXT | _BV(TWSTO) | _BV(TWSTA))
+#endif
+
+//the transfer at g_head is the one on the bus
+static twitransfer* volatile g_queue[TWI_QUEUESIZE];
+static volatile uint8_t      g_head;
+static volatile uint8_t      g_tail;
+
+static volatile uint8_t  g_index;
+static volatile bool     g_reading;
+static volatile uint32_t g_starttime;
+
+static twistats g_stats;
+
+#if defined(__AVR__)
+static void Begin(uint8_t twcr)
+{
+  g_index = 0;
+  g_reading = g_queue[g_head]->txlen == 0;
+  g_starttime = millis();
+  TWCR = twcr;
+}
+
+// ends the transfer on the bus and starts the next one, interrupts must be off
+static void Finish(uint8_t status)
+{
+  g_queue[g_head]->status = status;
+  g_head = (g_head + 1) & (TWI_QUEUESIZE - 1);
+
+  if (g_head != g_tail)
+    Begin(TWCR_STOPSTART);
+  else
+    TWCR = TWCR_STOP;
+}
+
+// the device didn't acknowledge its address, an EEPROM does that while it's
+// busy writing, so try again until it had time enough to finish
+static void Poll()
+{
+  if (millis() - g_starttime < TWI_POLLTIME)
+  {
+    g_stats.polls++;
+    g_index = 0;
+    g_reading = g_queue[g_head]->txlen == 0;
+    TWCR = TWCR_STOPSTART;
+  }
+  else
+  {
+    g_stats.nack++;
+    Finish(TWI_NACK);
+  }
+}
+#endif
+
+void TwiInit()
+{
+#if defined(__AVR__)
+  //the internal pullups, like the Wire library
+  digitalWrite(SDA, HIGH);
+  digitalWrite(SCL, HIGH);
+
+  TWSR = 0; //prescaler 1
+  TWBR = ((F_CPU / TWI_FREQ) - 16) / 2;
+  TWCR = _BV(TWEN) | _BV(TWIE);
+#endif
+}
+
+bool TwiQueue(twitransfer* transfer)
+{
+  transfer->status = TWI_PENDING;
+
+#if defined(__AVR__)
+  noInterrupts();
+  uint8_t next = (g_tail + 1) & (TWI_QUEUESIZE - 1);
+  if (next == g_head)
+  {
+    interrupts();
+    transfer->status = TWI_QUEUE_FULL;
+    return false;
+  }
+
+  bool idle = g_head == g_tail;
+  g_queue[g_tail] = transfer;
+  g_tail = next;
+
+  if (idle)
+  {
+    //a stop from the previous transfer may still be going out
+    while (TWCR & _BV(TWSTO))
+      ;
+    Begin(TWCR_START);
+  }
+  interrupts();
+#elif defined(NATIVE)
+  //the simulated bus runs the transfer right away, polling the same way
+  uint32_t start = millis();
+  uint8_t result;
+  while ((result = SimTwiTransfer(transfer->device, transfer->tx, transfer->txlen, transfer->rx, transfer->rxlen)) == SIM_TWI_ADDRNACK &&
+         millis() - start < TWI_POLLTIME)
+    g_stats.polls++;
+
+  if (result != SIM_TWI_ACK)
+    g_stats.nack++;
+  transfer->status = result == SIM_TWI_ACK ? TWI_DONE : TWI_NACK;
+#else
+  //no bus to put it on
+  g_stats.nack++;
+  transfer->status = TWI_NACK;
+#endif
+
+  return true;
+}
+
+bool TwiBusy()
+{
+  return g_head != g_tail;
+}
+
+void TwiProcess()
+{
+#if defined(__AVR__)
+  noInterrupts();
+  if (g_head != g_tail && millis() - g_starttime >= TWI_TIMEOUT)
+  {
+    //a device holding a line low hangs the TWI hardware, only turning it off
+    //and on again releases it
+    g_stats.timeout++;
+    TWCR = 0;
+    TWCR = _BV(TWEN) | _BV(TWIE);
+
+    g_queue[g_head]->status = TWI_TIMEOUT_ERROR;
+    g_head = (g_head + 1) & (TWI_QUEUESIZE - 1);
+    if (g_head != g_tail)
+      Begin(TWCR_START);
+  }
+  interrupts();
+#endif
+}
+
+uint8_t TwiWait(twitransfer* transfer)
+{
+  while (transfer->status == TWI_PENDING)
+    TwiProcess();
+
+  return transfer->status;
+}
+
+void TwiGetStats(twistats* stats)
+{
+  noInterrupts();
+  *stats = g_stats;
+  interrupts();
+}
+
+void TwiResetStats()
+{
+  noInterrupts();
+  memset(&g_stats, 0, sizeof(g_stats));
+  interrupts();
+}
+
+#if defined(__AVR__)
+ISR(TWI_vect)
+{
+  uint8_t start = LatencyISRStart();
+  twitransfer* transfer = g_queue[g_head];
+
+  switch (TW_STATUS)
+  {
+    case TW_START:
+    case TW_REP_START:
+      TWDR = (transfer->device << 1) | (g_reading ? TW_READ : TW_WRITE);
+      TWCR = TWCR_NEXT;
+      break;
+
+    case TW_MT_SLA_ACK:
+    case TW_MT_DATA_ACK:
+      if (g_index < transfer->txlen)
+      {
+        TWDR = transfer->tx[g_index++];
+        TWCR = TWCR_NEXT;
+      }
+      else if (transfer->rxlen != 0)
+      {
+        g_index = 0;
+        g_reading = true;
+        TWCR = TWCR_START;
+      }
+      else
+      {
+        Finish(TWI_DONE);
+      }
+      break;
+
+    case TW_MT_SLA_NACK:
+    case TW_MR_SLA_NACK:
+      Poll();
+      break;
+
+    case TW_MR_SLA_ACK:
+      //acknowledge every byte but the last
+      TWCR = transfer->rxlen > 1 ? TWCR_ACK : TWCR_NEXT;
+      break;
+
+    case TW_MR_DATA_ACK:
+      transfer->rx[g_index++] = TWDR;
+      TWCR = g_index < transfer->rxlen - 1 ? TWCR_ACK : TWCR_NEXT;
+      break;
+
+    case TW_MR_DATA_NACK:
+      transfer->rx[g_index++] = TWDR;
+      Finish(TWI_DONE);
+      break;
+
+    case TW_MT_ARB_LOST:
+      //there's no other master, this is noise, try again
+      TWCR = TWCR_START;
+      break;
+
+    default:
+      //a data NACK or a bus error
+      g_stats.nack++;
+      Finish(TWI_NACK);
+      break;
+  }
+
+  LatencyISREnd(LATENCY_TWI, start);
+}
+#endif
@@ -0,0 +1,70 @@
+#ifndef _TWI_H_
+#define _TWI_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Interrupt driven TWI master. A transfer writes tx, then, if rxlen isn't 0,
+// reads rxlen bytes after a repeated start. Transfers are queued and run one
+// after the other from the TWI interrupt, the caller polls their status.
+//
+// A device that doesn't acknowledge its address is polled again until
+// TWI_POLLTIME has passed, which is how an EEPROM signals it's still busy
+// with a write cycle. That way a write is done as soon as its bytes are on
+// the bus, and the wait for it happens in the background at the start of the
+// next transfer.
+//
+// The tx and rx buffers and the transfer itself must stay valid until the
+// status is no longer TWI_PENDING.
+
+#ifndef TWI_FREQ
+#define TWI_FREQ               100000L
+#endif
+
+#define TWI_QUEUESIZE          4   // must be a power of two
+#define TWI_POLLTIME           10  // ms, longer than any write cycle
+#define TWI_TIMEOUT            25  // ms, a transfer still busy after this resets the bus
+
+// status of a transfer
+#define TWI_PENDING            0
+#define TWI_DONE               1
+#define TWI_NACK               2   // not acknowledged, or a bus error
+#define TWI_TIMEOUT_ERROR      3
+#define TWI_QUEUE_FULL         4   // never queued
+
+struct twitransfer
+{
+  uint8_t          device;   // 7 bit address
+  uint8_t          txlen;
+  const uint8_t*   tx;
+  uint8_t          rxlen;
+  uint8_t*         rx;
+  volatile uint8_t status;
+};
+
+struct twistats
+{
+  uint16_t nack;
+  uint16_t timeout;
+  uint16_t polls;     // address NACKs polled again, mostly waiting for write cycles
+};
+
+void TwiInit();
+
+// returns false and sets the status to TWI_QUEUE_FULL if there's no room
+bool TwiQueue(twitransfer* transfer);
+
+// true while any transfer is queued or running
+bool TwiBusy();
+
+// checks the running transfer for a timeout, call this from the loop while
+// TwiBusy()
+void TwiProcess();
+
+// waits until the transfer is no longer pending, returns its status
+uint8_t TwiWait(twitransfer* transfer);
+
+void TwiGetStats(twistats* stats);
+void TwiResetStats();
+
+#endif /* _TWI_H_ */
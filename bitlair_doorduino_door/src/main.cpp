@@ -1,145 +1,168 @@
 #include <Arduino.h>
 
-// this pin should connect to Ground when want to stop the motor
-#define STOPPER_PIN 4
-
-// Motor steps per revolution. Most steppers are 200 steps or 1.8 degrees/step
-#define MOTOR_STEPS 400
-#define RPM 60
-// Acceleration and deceleration values are always in FULL steps / s^2
-#define MOTOR_ACCEL 2000
-#define MOTOR_DECEL 1000
-
-// Microstepping mode. If you hardwired it to save pins, set to the same value here.
-#define MICROSTEPS 8
-
-#define DIR 10
-#define STEP 11
-#define ENABLE A3 // optional (just delete ENABLE from everywhere if not used)
-
-#define SLEEP 12
-#define RESET 13
-
-#include "A4988.h"
-#define MS1 A2
-#define MS2 A1
-#define MS3 A0
-A4988 stepper(MOTOR_STEPS, DIR, STEP, ENABLE, MS1, MS2, MS3);
-
-
-#include <ams_as5048b.h>
-
-//unit consts
-#define U_RAW 1
-#define U_TRN 2
-#define U_DEG 3
-#define U_RAD 4
-#define U_GRAD 5
-#define U_MOA 6
-#define U_SOA 7
-#define U_MILNATO 8
-#define U_MILSE 9
-#define U_MILRU 10
-
-AMS_AS5048B mysensor;
-
+#include "motion.h"
+#include "stall.h"
 
 #define DOOR_OPEN   3
 #define DOOR_CLOSE  2
+// driven low once a move has finished or stalled, so the lock controller can
+// drop door power right away, high while moving
+#define DOOR_DONE   5
 
 #define STATE_IDLE  0
 #define STATE_OPEN  1
 #define STATE_CLOSE 2
+#define STATE_CALIBRATE 3
 int state = STATE_IDLE;
-int angle_prev = 0;
-int angle = 0;
-int angle_steps = 0;
 
-void setup() {
-    Serial.begin(115200);
+// time after a move before the next command is started
+#define COOLDOWN_TIME 1000
+
+// set from the rising edge interrupts on DOOR_OPEN and DOOR_CLOSE, a command
+// that arrives during a move or the cooldown waits here until it's over
+volatile int pending_command = STATE_IDLE;
+unsigned long cooldown_start;
+
+void OnDoorOpen() {
+    pending_command = STATE_OPEN;
+}
+
+void OnDoorClose() {
+    pending_command = STATE_CLOSE;
+}
+
+void StartMove(int command) {
+    state = command;
+    digitalWrite(DOOR_DONE, HIGH);
+
+    if (command == STATE_OPEN){
+      Serial.println("RECEIVED OPEN");
+      MotionStart(MOTION_OPEN);
+    } else if (command == STATE_CLOSE){
+      Serial.println("RECEIVED CLOSE");
+      MotionStart(MOTION_CLOSE);
+    } else {
+      MotionStartCalibration();
+    }
+}
 
-    pinMode(SLEEP, OUTPUT);
-    pinMode(RESET, OUTPUT);
-    digitalWrite(SLEEP, HIGH);
-    digitalWrite(RESET, HIGH);
+void FinishMove() {
+    digitalWrite(DOOR_DONE, LOW);
 
-    // Configure stopper pin to read HIGH unless grounded
-    pinMode(STOPPER_PIN, INPUT_PULLUP);
+    state = STATE_IDLE;
+    cooldown_start = millis();
+    Serial.println("FINISHED");
+}
 
-    stepper.begin(RPM, MICROSTEPS);
-    stepper.disable();
+void setup() {
+    pinMode(DOOR_DONE, OUTPUT);
+    digitalWrite(DOOR_DONE, HIGH);
 
-    //stepper.setSpeedProfile(stepper.LINEAR_SPEED, MOTOR_ACCEL, MOTOR_DECEL);
-    stepper.setSpeedProfile(stepper.CONSTANT_SPEED, MOTOR_ACCEL, MOTOR_DECEL);
+    Serial.begin(115200);
 
-    //init AMS_AS5048B object
-    mysensor.begin();
+    MotionInit();
 
     pinMode(DOOR_OPEN, INPUT);
     pinMode(DOOR_CLOSE, INPUT);
 
     Serial.println("START");
 
-    stepper.setEnableActiveState(LOW);
-//    stepper.enable();
-//    stepper.rotate(360);
-//    Serial.println("START2");
-
-    if (digitalRead(DOOR_OPEN) == HIGH && state == STATE_IDLE){
-      state = STATE_OPEN;
-      Serial.println("RECEIVED OPEN");
-      stepper.enable();
-      stepper.startRotate(-900);
+    // the lock controller powers this board up together with the command
+    // line, so a line that is already high at boot counts as a command too
+    if (digitalRead(DOOR_OPEN) == HIGH){
+      pending_command = STATE_OPEN;
+    } else if (digitalRead(DOOR_CLOSE) == HIGH){
+      pending_command = STATE_CLOSE;
+    } else {
+      digitalWrite(DOOR_DONE, LOW);
     }
-    if (digitalRead(DOOR_CLOSE) == HIGH && state == STATE_IDLE){
-      state = STATE_CLOSE;
-      Serial.println("RECEIVED CLOSE");
-      stepper.enable();
-      stepper.startRotate(900);
+
+    attachInterrupt(digitalPinToInterrupt(DOOR_OPEN), OnDoorOpen, RISING);
+    attachInterrupt(digitalPinToInterrupt(DOOR_CLOSE), OnDoorClose, RISING);
+
+    cooldown_start = millis() - COOLDOWN_TIME;
+}
+
+// serial commands, only read while idle so printing never slows down a move
+//   dump                              prints the settings, the calibration and the last trajectory
+//   stall <minspeed> <armtime> <window>  changes the stall settings
+//   calibrate                         learns the closed and open stops
+#define CMD_SIZE 32
+char cmd_buf[CMD_SIZE];
+int cmd_len = 0;
+
+void ParseCommand(char* cmd) {
+    if (strcmp(cmd, "dump") == 0){
+      MotionDump();
+      StallDump();
+    } else if (strcmp(cmd, "calibrate") == 0){
+      StartMove(STATE_CALIBRATE);
+    } else if (strncmp(cmd, "stall ", 6) == 0){
+      char* pos = cmd + 6;
+      stallsettings settings;
+      settings.minspeed = strtoul(pos, &pos, 10);
+      settings.armtime = strtoul(pos, &pos, 10);
+      settings.window = strtoul(pos, &pos, 10);
+
+      if (StallSetSettings(&settings)){
+        StallDump();
+      } else {
+        Serial.println("ERROR: invalid stall settings");
+      }
+    } else {
+      Serial.print("ERROR: unknown command ");
+      Serial.println(cmd);
     }
+}
 
+void ReadCommands() {
+    while (Serial.available()){
+      char c = Serial.read();
+      if (c == '\r'){
+        continue;
+      } else if (c == '\n'){
+        cmd_buf[cmd_len] = 0;
+        if (cmd_len > 0){
+          ParseCommand(cmd_buf);
+        }
+        cmd_len = 0;
+      } else if (cmd_len < CMD_SIZE - 1){
+        cmd_buf[cmd_len++] = c;
+      }
+    }
 }
 
 void loop() {
-    static int step = 0;
-
-    if(state != STATE_IDLE && millis()%50 == 0){
-      angle_prev = angle;
-      angle = mysensor.angleR(U_DEG, true);
-      angle_steps++;
-        Serial.print("Time : ");
-        Serial.print(millis(), DEC);
-        Serial.print("    Angle : ");
-        Serial.print(angle, DEC);
-        Serial.print("  angle prev : ");
-        Serial.println(angle_prev, DEC);
-
-      if(angle_steps > 5 && (angle_prev - angle) >= -5 && (angle_prev - angle) <= 5){
-          Serial.println("STOPPER REACHED");
-          stepper.stop();
-          stepper.disable();
-  
-          state = STATE_IDLE;
-          step = 0;
-          angle_steps = 0;
-          delay(10000);
-          Serial.println("FINISHED");
+    if (state == STATE_IDLE){
+      if (pending_command != STATE_IDLE && millis() - cooldown_start >= COOLDOWN_TIME){
+        noInterrupts();
+        int command = pending_command;
+        pending_command = STATE_IDLE;
+        interrupts();
+
+        StartMove(command);
+      } else {
+        ReadCommands();
       }
+      return;
     }
 
-    // motor control loop - send pulse and return how long to wait until next pulse
-    unsigned wait_time = stepper.nextAction();
-//  Serial.println(wait_time);
-    step++;
-
-    // 0 wait time indicates the motor has stopped
-    if (state != STATE_IDLE && wait_time <= 0) {
-        stepper.disable();       // comment out to keep motor powered
-        Serial.println("END");
-        state = STATE_IDLE;
-        step = 0;
-        angle_steps = 0;
-        delay(10000);
-        Serial.println("FINISHED");
+    uint8_t result = MotionRun();
+    if (result == MOTION_BUSY){
+      return;
+    }
+
+    if (result == MOTION_STOPPER){
+      Serial.println("STOPPER REACHED");
+    } else if (result == MOTION_STALLED){
+      Serial.println("STALLED");
+    } else if (result == MOTION_FAILED){
+      Serial.println("FAILED");
+    } else {
+      Serial.println("END");
+    }
+    if (StallStarved()){
+      Serial.println("STALL DETECTION OFF, STEPS TOO FAST TO SAMPLE");
     }
+    FinishMove();
 }
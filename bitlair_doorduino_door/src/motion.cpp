@@ -0,0 +1,382 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <Arduino.h>
+#include <EEPROM.h>
+
+#include "motion.h"
+#include "stall.h"
+
+// this pin should connect to Ground when want to stop the motor
+#define STOPPER_PIN 4
+#define STOPPER_ARM_TIME       5   // ms the stopper must read released before it can stop a move
+
+// Motor steps per revolution. Most steppers are 200 steps or 1.8 degrees/step
+#define MOTOR_STEPS 400
+#define RPM 60
+// Acceleration and deceleration values are always in FULL steps / s^2
+#define MOTOR_ACCEL 2000
+#define MOTOR_DECEL 1000
+
+// Microstepping mode. If you hardwired it to save pins, set to the same value here.
+#define MICROSTEPS 8
+
+#define DIR 10
+#define STEP 11
+#define ENABLE A3 // optional (just delete ENABLE from everywhere if not used)
+
+#define SLEEP 12
+#define RESET 13
+
+#include "A4988.h"
+#define MS1 A2
+#define MS2 A1
+#define MS3 A0
+A4988 stepper(MOTOR_STEPS, DIR, STEP, ENABLE, MS1, MS2, MS3);
+
+#define HOMING_ROTATE          900 // deg, far enough to reach a stop from anywhere
+
+// all in encoder counts, 16384 per turn
+#define START_TOLERANCE        364 // a door further than this from the stop it should start at is homed
+#define STOP_MARGIN            91  // how far short of the stop a planned move aims
+#define CORRECT_TOLERANCE      45  // a larger error after a planned move is corrected once
+
+#define CAL_ADDRESS            0
+#define CAL_MAGIC              0xD5
+#define CAL_RATIO_TIME         500 // ms into the opening run where the steps per count are measured
+#define POS_ADDRESS            (CAL_ADDRESS + sizeof(calibration))
+#define POS_MAGIC              0xA7
+
+#define MODE_IDLE              0
+#define MODE_HOMING            1
+#define MODE_PLANNED           2
+#define MODE_CORRECTING        3
+#define MODE_CAL_CLOSE         4
+#define MODE_CAL_OPEN          5
+
+struct calibration
+{
+  uint8_t  magic;
+  uint16_t closedangle; // raw encoder angles at the stops
+  uint16_t openangle;
+  int32_t  counts;      // encoder counts from the closed to the open stop
+  int32_t  steps;       // motor steps from the closed to the open stop
+};
+
+// where the door stopped, in counts from the closed stop
+struct doorposition
+{
+  uint8_t  magic;
+  int32_t  counts;
+};
+
+static calibration  g_cal;
+static bool         g_calibrated;
+static doorposition g_doorpos;
+
+static uint8_t  g_mode;
+static uint8_t  g_target;      // MOTION_OPEN or MOTION_CLOSE
+static uint16_t g_startangle;  // raw encoder angle at StallStart()
+static int32_t  g_startpos;    // counts from the closed stop at StallStart()
+static int32_t  g_targetpos;
+static uint32_t g_steps;       // pulses given since StallStart()
+static uint32_t g_movestart;
+static int32_t  g_ratiosteps;  // measured during the calibration
+static int32_t  g_ratiocounts;
+
+static volatile bool g_stopperhit;
+static volatile bool g_stopperarmed;
+static uint32_t      g_stopperreleased; // last time the stopper read pressed while not armed
+
+static void ArmStopper()
+{
+  noInterrupts();
+  g_stopperhit = false;
+  g_stopperarmed = false;
+  interrupts();
+  g_stopperreleased = millis();
+}
+
+// a switch that is already pressed, or still bouncing, must not end the move
+// that just started, it only counts once it read released for a while
+static void CheckStopperArmed()
+{
+  if (g_stopperarmed)
+    return;
+
+  if (digitalRead(STOPPER_PIN) == LOW)
+    g_stopperreleased = millis();
+  else if (millis() - g_stopperreleased >= STOPPER_ARM_TIME)
+    g_stopperarmed = true;
+}
+
+static void SavePosition(bool known, int32_t counts)
+{
+  g_doorpos.magic = known ? POS_MAGIC : 0;
+  g_doorpos.counts = counts;
+  EEPROM.put(POS_ADDRESS, g_doorpos);
+}
+
+static void StartStall()
+{
+  g_startangle = StallStart();
+  g_steps = 0;
+  g_movestart = millis();
+}
+
+static void StartHoming(uint8_t target)
+{
+  stepper.setSpeedProfile(stepper.CONSTANT_SPEED, MOTOR_ACCEL, MOTOR_DECEL);
+  stepper.startRotate(target == MOTION_OPEN ? -HOMING_ROTATE : HOMING_ROTATE);
+}
+
+static void StartSteps(int32_t counts, bool profiled)
+{
+  int32_t steps = counts * g_cal.steps / g_cal.counts;
+
+  if (profiled)
+    stepper.setSpeedProfile(stepper.LINEAR_SPEED, MOTOR_ACCEL, MOTOR_DECEL);
+  else
+    stepper.setSpeedProfile(stepper.CONSTANT_SPEED, MOTOR_ACCEL, MOTOR_DECEL);
+
+  stepper.startMove(steps);
+}
+
+// difference between two raw angles, within half a turn
+static int16_t AngleDiff(uint16_t a, uint16_t b)
+{
+  int16_t diff = (a - b) & (STALL_COUNTS - 1);
+  if (diff >= STALL_COUNTS / 2)
+    diff -= STALL_COUNTS;
+
+  return diff;
+}
+
+void MotionInit()
+{
+  pinMode(SLEEP, OUTPUT);
+  pinMode(RESET, OUTPUT);
+  digitalWrite(SLEEP, HIGH);
+  digitalWrite(RESET, HIGH);
+
+  // Configure stopper pin to read HIGH unless grounded
+  pinMode(STOPPER_PIN, INPUT_PULLUP);
+#if defined(__AVR__)
+  *digitalPinToPCMSK(STOPPER_PIN) |= _BV(digitalPinToPCMSKbit(STOPPER_PIN));
+  PCIFR = _BV(digitalPinToPCICRbit(STOPPER_PIN));
+  PCICR |= _BV(digitalPinToPCICRbit(STOPPER_PIN));
+#endif
+
+  stepper.begin(RPM, MICROSTEPS);
+  stepper.setEnableActiveState(LOW);
+  stepper.disable();
+
+  StallInit();
+
+  EEPROM.get(CAL_ADDRESS, g_cal);
+  g_calibrated = g_cal.magic == CAL_MAGIC && g_cal.counts != 0 && g_cal.steps != 0;
+  EEPROM.get(POS_ADDRESS, g_doorpos);
+  g_mode = MODE_IDLE;
+}
+
+void MotionStart(uint8_t target)
+{
+  ArmStopper();
+  stepper.enable();
+  StartStall();
+  g_target = target;
+
+  bool known = g_doorpos.magic == POS_MAGIC;
+  int32_t lastpos = g_doorpos.counts;
+  if (known)
+    SavePosition(false, lastpos);
+
+  if (!g_calibrated)
+  {
+    g_mode = MODE_HOMING;
+    StartHoming(target);
+    return;
+  }
+
+  //where the door should be, and where it really is, the raw angle only
+  //tells that within a turn, the position it stopped at last tells which turn
+  int32_t from = target == MOTION_OPEN ? 0 : g_cal.counts;
+  int32_t at = lastpos + AngleDiff(g_startangle, (g_cal.closedangle + lastpos) & (STALL_COUNTS - 1));
+  if (!known || abs(at - from) > START_TOLERANCE)
+  {
+    Serial.println("POSITION UNKNOWN, HOMING");
+    g_mode = MODE_HOMING;
+    StartHoming(target);
+    return;
+  }
+
+  int32_t to = target == MOTION_OPEN ? g_cal.counts : 0;
+  to += to > from ? -STOP_MARGIN : STOP_MARGIN;
+
+  g_startpos = at;
+  g_targetpos = to;
+  g_mode = MODE_PLANNED;
+  StartSteps(g_targetpos - g_startpos, true);
+}
+
+void MotionStartCalibration()
+{
+  Serial.println("CALIBRATING");
+  g_calibrated = false;
+  ArmStopper();
+  if (g_doorpos.magic == POS_MAGIC)
+    SavePosition(false, 0);
+  stepper.enable();
+  g_mode = MODE_CAL_CLOSE;
+  StartStall();
+  StartHoming(MOTION_CLOSE);
+}
+
+static uint8_t CalibrationStop(uint8_t result)
+{
+  int32_t position = StallReadPosition();
+  uint16_t angle = (g_startangle + position) & (STALL_COUNTS - 1);
+
+  if (result == MOTION_END || (g_mode == MODE_CAL_OPEN && g_ratiocounts == 0))
+  {
+    Serial.println("CALIBRATION FAILED");
+    return MOTION_FAILED;
+  }
+
+  if (g_mode == MODE_CAL_CLOSE)
+  {
+    g_cal.closedangle = angle;
+    g_ratiosteps = 0;
+    g_ratiocounts = 0;
+    g_mode = MODE_CAL_OPEN;
+    ArmStopper();
+    StartStall();
+    StartHoming(MOTION_OPEN);
+    return MOTION_BUSY;
+  }
+
+  //the steps given while pushing against the stop don't count, so the travel
+  //in steps comes from the ratio measured while the door was still moving
+  g_cal.magic = CAL_MAGIC;
+  g_cal.openangle = angle;
+  g_cal.counts = position;
+  g_cal.steps = position * g_ratiosteps / g_ratiocounts;
+  EEPROM.put(CAL_ADDRESS, g_cal);
+  g_calibrated = true;
+
+  Serial.print("CALIBRATED counts ");
+  Serial.print(g_cal.counts, DEC);
+  Serial.print(" steps ");
+  Serial.println(g_cal.steps, DEC);
+
+  //closing again checks the calibration
+  g_doorpos.magic = POS_MAGIC;
+  g_doorpos.counts = g_cal.counts;
+  MotionStart(MOTION_CLOSE);
+  return MOTION_BUSY;
+}
+
+static uint8_t MoveStopped(uint8_t result)
+{
+  stepper.stop();
+
+  if (g_mode == MODE_CAL_CLOSE || g_mode == MODE_CAL_OPEN)
+  {
+    result = CalibrationStop(result);
+    if (result == MOTION_BUSY)
+      return result;
+  }
+  else if (g_mode == MODE_PLANNED && result == MOTION_END)
+  {
+    int32_t error = g_targetpos - (g_startpos + StallReadPosition());
+    if (abs(error) > CORRECT_TOLERANCE)
+    {
+      g_startpos += StallPosition();
+      StartStall();
+      g_mode = MODE_CORRECTING;
+      StartSteps(error, false);
+      return MOTION_BUSY;
+    }
+  }
+
+  //a homing move only knows where it ended if that's near the stop it went to
+  if (g_mode == MODE_PLANNED || g_mode == MODE_CORRECTING)
+  {
+    SavePosition(true, g_startpos + StallReadPosition());
+  }
+  else if (g_mode == MODE_HOMING && g_calibrated && result != MOTION_END)
+  {
+    uint16_t angle = (g_startangle + StallReadPosition()) & (STALL_COUNTS - 1);
+    bool open = g_target == MOTION_OPEN;
+    int16_t offset = AngleDiff(angle, open ? g_cal.openangle : g_cal.closedangle);
+    if (abs(offset) <= START_TOLERANCE)
+      SavePosition(true, (open ? g_cal.counts : 0) + offset);
+  }
+
+  stepper.disable();       // comment out to keep motor powered
+  g_mode = MODE_IDLE;
+
+  return result;
+}
+
+uint8_t MotionRun()
+{
+  //a low that is gone again by now was a spike, not the switch
+  if (g_stopperhit)
+  {
+    if (digitalRead(STOPPER_PIN) == LOW)
+      return MoveStopped(MOTION_STOPPER);
+    g_stopperhit = false;
+  }
+  CheckStopperArmed();
+
+  // motor control loop - send pulse and return how long to wait until next pulse
+  unsigned wait_time = stepper.nextAction();
+
+  // 0 wait time indicates the motor has stopped
+  if (wait_time <= 0)
+    return MoveStopped(MOTION_END);
+
+  g_steps++;
+
+  // read the encoder in the time until the next pulse is due, if it fits
+  if (StallSampleDue(wait_time))
+  {
+    if (StallSample())
+      return MoveStopped(MOTION_STALLED);
+
+    if (g_mode == MODE_CAL_OPEN && g_ratiocounts == 0 && millis() - g_movestart >= CAL_RATIO_TIME)
+    {
+      g_ratiosteps = -(int32_t)g_steps;
+      g_ratiocounts = StallPosition();
+    }
+  }
+
+  return MOTION_BUSY;
+}
+
+void MotionDump()
+{
+  if (!g_calibrated)
+  {
+    Serial.println("calibration none");
+    return;
+  }
+
+  Serial.print("calibration closed ");
+  Serial.print(g_cal.closedangle, DEC);
+  Serial.print(" open ");
+  Serial.print(g_cal.openangle, DEC);
+  Serial.print(" counts ");
+  Serial.print(g_cal.counts, DEC);
+  Serial.print(" steps ");
+  Serial.println(g_cal.steps, DEC);
+}
+
+#if defined(__AVR__)
+ISR(PCINT2_vect)
+{
+  if (g_stopperarmed && digitalRead(STOPPER_PIN) == LOW)
+    g_stopperhit = true;
+}
+#endif
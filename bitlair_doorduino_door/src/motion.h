@@ -0,0 +1,48 @@
+#ifndef _MOTION_H_
+#define _MOTION_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Moves the door between its end stops. A calibration run drives the door to
+// both stops and stores their encoder angles and the travel between them in
+// the internal EEPROM. With that, a move is planned from the angle the door
+// starts at: it accelerates, cruises and decelerates to just short of the stop,
+// then corrects once by the encoder if it fell short. Without a calibration,
+// or when the door isn't where it's expected, the move homes at constant speed
+// until it stalls, like it always did. The stopper switch ends any move at
+// once, after it was seen released at some point of the move.
+//
+// Where the door ended is kept in the EEPROM as well, in counts from the
+// closed stop across any number of turns, so a door that is a whole turn off
+// isn't taken for one at its stop. It's cleared while a move is busy, a board
+// that lost power during one homes on the next.
+
+// targets
+#define MOTION_OPEN            1
+#define MOTION_CLOSE           2
+
+// results of MotionRun()
+#define MOTION_BUSY            0
+#define MOTION_END             1   // reached the target, or the end of a homing move
+#define MOTION_STALLED         2
+#define MOTION_STOPPER         3
+#define MOTION_FAILED          4   // calibration didn't find a stop
+
+// sets up the stepper, the stopper switch and the encoder, and loads the
+// calibration
+void MotionInit();
+
+void MotionStart(uint8_t target);
+
+// closes, opens and closes the door again, learning both stops on the way
+void MotionStartCalibration();
+
+// gives the stepper its next pulse, call this as often as possible while a
+// move is busy, the motor is off once it returns something else than MOTION_BUSY
+uint8_t MotionRun();
+
+// prints the calibration
+void MotionDump();
+
+#endif /* _MOTION_H_ */
@@ -0,0 +1,285 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <Arduino.h>
+#include <Wire.h>
+#include <ams_as5048b.h>
+
+#include "stall.h"
+
+#define WINDOW_RINGSIZE        (STALL_WINDOW_MAX + 1)
+#define I2C_CLOCK              400000L
+
+#define READ_TIME_GUESS        150 // us, until the first read is measured
+#define READ_TIME_MAX          1000 // us, a slower read counts as this much
+#define READ_MARGIN            20  // us
+#define READ_AVERAGE           8   // a new read counts for 1/8 of the average
+
+#if (WINDOW_RINGSIZE & (WINDOW_RINGSIZE - 1)) != 0
+#error "STALL_WINDOW_MAX + 1 must be a power of two"
+#endif
+#if (TRAJ_RINGSIZE & (TRAJ_RINGSIZE - 1)) != 0
+#error "TRAJ_RINGSIZE must be a power of two"
+#endif
+
+struct windowsample
+{
+  int32_t  position; // unwrapped, in encoder counts since the start of the move
+  uint16_t time;     // ms since the start of the move
+};
+
+struct trajsample
+{
+  uint16_t time;
+  uint16_t angle;    // raw encoder value
+  int16_t  speed;    // deg/s over the window
+};
+
+static AMS_AS5048B g_sensor;
+
+static stallsettings g_settings = { STALL_MIN_SPEED, STALL_ARM_TIME, STALL_WINDOW };
+
+//written by the timer interrupt
+static volatile bool     g_slotpending;
+static volatile uint32_t g_slottime;
+static volatile uint8_t  g_slotticks;
+static volatile uint16_t g_slotsmissed;
+static volatile uint8_t  g_slotsskipped; // missed in a row since the last sample
+
+static uint32_t g_starttime;
+static uint16_t g_samples;
+static uint16_t g_lastangle;
+static int32_t  g_position;
+static uint16_t g_readtime;    // us a read is expected to take
+static uint16_t g_readaverage; // times READ_AVERAGE
+static uint16_t g_readmax;
+static bool     g_readmeasured;
+static uint8_t  g_readskipped; // g_slotsskipped when g_readtime was last lowered
+static bool     g_starved;
+
+static windowsample g_window[WINDOW_RINGSIZE];
+static trajsample   g_traj[TRAJ_RINGSIZE];
+
+void StallInit()
+{
+  g_sensor.begin();
+  //a read takes about 400 us at the default 100 kHz, too long to fit between steps
+  Wire.setClock(I2C_CLOCK);
+
+  g_readtime = READ_TIME_GUESS;
+  g_readaverage = READ_TIME_GUESS * READ_AVERAGE;
+  g_readmax = 0;
+  g_readmeasured = false;
+
+#if defined(__AVR__)
+  //timer 0 overflows once per millis() tick, the compare match halfway adds an interrupt at the same rate
+  OCR0A = 0x80;
+  TIMSK0 |= _BV(OCIE0A);
+#endif
+}
+
+uint16_t StallStart()
+{
+  noInterrupts();
+  g_slotpending = false;
+  g_slotticks = 0;
+  g_slotsmissed = 0;
+  g_slotsskipped = 0;
+  interrupts();
+
+  g_readskipped = 0;
+  g_starved = false;
+  g_starttime = millis();
+  g_samples = 0;
+  g_position = 0;
+  g_lastangle = g_sensor.angleRegR();
+
+  return g_lastangle;
+}
+
+bool StallSampleDue(uint32_t slack)
+{
+  if (!g_slotpending)
+    return false;
+
+  //another slot went by without a sample, trust the estimate a bit less
+  uint8_t skipped = g_slotsskipped;
+  if (skipped != g_readskipped)
+  {
+    g_readskipped = skipped;
+    g_readaverage -= g_readaverage / READ_AVERAGE;
+    g_readtime = g_readaverage / READ_AVERAGE;
+    if (skipped >= STALL_STARVED_SLOTS)
+      g_starved = true;
+  }
+
+  return slack >= (uint32_t)g_readtime + READ_MARGIN;
+}
+
+static int16_t WindowSpeed(const windowsample* now)
+{
+  uint8_t window = g_samples > g_settings.window ? g_settings.window : g_samples;
+  if (window == 0)
+    return 0;
+
+  const windowsample* then = &g_window[(g_samples - window) & (WINDOW_RINGSIZE - 1)];
+  uint16_t dt = now->time - then->time;
+  if (dt == 0)
+    return 0;
+
+  int32_t speed = (now->position - then->position) * 1000 / dt * 360 / STALL_COUNTS;
+  if (speed > INT16_MAX)
+    return INT16_MAX;
+  else if (speed < -INT16_MAX)
+    return -INT16_MAX;
+
+  return speed;
+}
+
+// moves g_position along to a new encoder reading
+static void UpdatePosition(uint16_t angle)
+{
+  int16_t delta = (angle - g_lastangle) & (STALL_COUNTS - 1);
+  if (delta >= STALL_COUNTS / 2)
+    delta -= STALL_COUNTS;
+  g_position += delta;
+  g_lastangle = angle;
+}
+
+bool StallSample()
+{
+  noInterrupts();
+  uint32_t slottime = g_slottime;
+  g_slotpending = false;
+  g_slotsskipped = 0;
+  interrupts();
+  g_readskipped = 0;
+
+  uint32_t readstart = micros();
+  uint16_t angle = g_sensor.angleRegR();
+  uint16_t readtime = micros() - readstart;
+
+  if (readtime > g_readmax)
+    g_readmax = readtime;
+  if (readtime > READ_TIME_MAX)
+    readtime = READ_TIME_MAX;
+
+  //the first read replaces the guess
+  if (!g_readmeasured)
+    g_readaverage = readtime * READ_AVERAGE;
+  else
+    g_readaverage += readtime - g_readaverage / READ_AVERAGE;
+  g_readtime = g_readaverage / READ_AVERAGE;
+  g_readmeasured = true;
+
+  UpdatePosition(angle);
+
+  windowsample* sample = &g_window[g_samples & (WINDOW_RINGSIZE - 1)];
+  sample->position = g_position;
+  sample->time = slottime - g_starttime;
+
+  int16_t speed = WindowSpeed(sample);
+
+  trajsample* traj = &g_traj[g_samples & (TRAJ_RINGSIZE - 1)];
+  traj->time = sample->time;
+  traj->angle = angle;
+  traj->speed = speed;
+
+  g_samples++;
+
+  if (g_samples <= g_settings.window || sample->time < g_settings.armtime)
+    return false;
+
+  return abs(speed) < (int16_t)g_settings.minspeed;
+}
+
+bool StallStarved()
+{
+  return g_starved;
+}
+
+int32_t StallPosition()
+{
+  return g_position;
+}
+
+int32_t StallReadPosition()
+{
+  UpdatePosition(g_sensor.angleRegR());
+
+  return g_position;
+}
+
+void StallGetSettings(stallsettings* settings)
+{
+  *settings = g_settings;
+}
+
+bool StallSetSettings(const stallsettings* settings)
+{
+  if (settings->window < 1 || settings->window > STALL_WINDOW_MAX)
+    return false;
+  if (settings->minspeed > INT16_MAX)
+    return false;
+
+  g_settings = *settings;
+  return true;
+}
+
+void StallDump()
+{
+  Serial.print("stall minspeed ");
+  Serial.print(g_settings.minspeed, DEC);
+  Serial.print(" armtime ");
+  Serial.print(g_settings.armtime, DEC);
+  Serial.print(" window ");
+  Serial.println(g_settings.window, DEC);
+
+  uint16_t kept = g_samples < TRAJ_RINGSIZE ? g_samples : TRAJ_RINGSIZE;
+
+  Serial.print("trajectory samples ");
+  Serial.print(g_samples, DEC);
+  Serial.print(" kept ");
+  Serial.print(kept, DEC);
+  Serial.print(" missed ");
+  Serial.print(g_slotsmissed, DEC);
+  Serial.print(" readtime ");
+  Serial.print(g_readtime, DEC);
+  Serial.print(" readmax ");
+  Serial.print(g_readmax, DEC);
+  Serial.print(" starved ");
+  Serial.println(g_starved ? 1 : 0, DEC);
+
+  //time in ms, angle in tenths of a degree, speed in deg/s
+  for (uint16_t i = g_samples - kept; i != g_samples; i++)
+  {
+    trajsample* traj = &g_traj[i & (TRAJ_RINGSIZE - 1)];
+    Serial.print(traj->time, DEC);
+    Serial.print(' ');
+    Serial.print((uint32_t)traj->angle * 3600 / STALL_COUNTS, DEC);
+    Serial.print(' ');
+    Serial.println(traj->speed, DEC);
+  }
+
+  Serial.println("trajectory end");
+}
+
+#if defined(__AVR__)
+ISR(TIMER0_COMPA_vect)
+{
+  if (++g_slotticks < STALL_INTERVAL)
+    return;
+
+  g_slotticks = 0;
+  //the previous slot was never taken because the steps came too fast
+  if (g_slotpending)
+  {
+    g_slotsmissed++;
+    if (g_slotsskipped < UINT8_MAX)
+      g_slotsskipped++;
+  }
+
+  g_slottime = millis();
+  g_slotpending = true;
+}
+#endif
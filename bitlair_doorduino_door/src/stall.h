@@ -0,0 +1,76 @@
+#ifndef _STALL_H_
+#define _STALL_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Stall detection from the AS5048B angle. The timer 0 compare interrupt marks
+// a sample slot every STALL_INTERVAL ms, the loop takes the sample right after
+// a stepper pulse once it knows the pulse wait leaves enough time for the I2C
+// read, so the read never delays a step. The speed is averaged over a window
+// of samples and every sample is kept in a ring that can be dumped over serial.
+//
+// How long a read takes is a running average, so one slow read doesn't keep
+// the loop from sampling for good. While slots are missed the estimate comes
+// down again, until a read is tried and measured. A move that went without a
+// sample for STALL_STARVED_SLOTS slots in a row had no stall detection for
+// that time, StallStarved() tells.
+
+#define STALL_COUNTS           16384 // encoder counts per turn
+#define STALL_INTERVAL         10  // ms between samples
+#define STALL_STARVED_SLOTS    20  // slots in a row without a sample
+
+#ifndef STALL_WINDOW_MAX
+#define STALL_WINDOW_MAX       15  // samples, one less than a power of two
+#endif
+
+#ifndef TRAJ_RINGSIZE
+#define TRAJ_RINGSIZE          64  // must be a power of two
+#endif
+
+// defaults for the settings that can be changed over serial
+#define STALL_MIN_SPEED        20  // deg/s, slower than this over the window is a stall
+#define STALL_ARM_TIME         300 // ms after the start of a move before a stall can trigger
+#define STALL_WINDOW           8   // samples
+
+struct stallsettings
+{
+  uint16_t minspeed;
+  uint16_t armtime;
+  uint8_t  window;
+};
+
+// starts the sample timer, call after the encoder is set up
+void StallInit();
+
+// clears the window and the trajectory and returns the raw encoder angle the
+// move starts from, call when a move starts
+uint16_t StallStart();
+
+// true if a sample slot is pending and slack us is enough time to read the
+// encoder, pass the wait returned by stepper.nextAction()
+bool StallSampleDue(uint32_t slack);
+
+// reads the encoder and records the sample, returns true when the door stalled
+bool StallSample();
+
+// true if stall detection was off for a while during the move, because the
+// steps came too fast to read the encoder between them
+bool StallStarved();
+
+// encoder counts moved since StallStart() at the last sample, unwrapped
+// across turns
+int32_t StallPosition();
+
+// same, but reads the encoder first, call this once the motor stopped
+int32_t StallReadPosition();
+
+void StallGetSettings(stallsettings* settings);
+
+// returns false if a setting is out of range
+bool StallSetSettings(const stallsettings* settings);
+
+// prints the settings and the samples of the last move
+void StallDump();
+
+#endif /* _STALL_H_ */
@@ -1,9 +1,13 @@
 #include "OneWire.h"
 #include "ds1961.h"
+#include "Entropy.h"
 
 #include <stdint.h>
 
-#define PIN_1WIRE              2
+#define PIN_1WIRE              2   // also the first station pad
+#define PIN_PAD2               5
+#define PIN_PAD3               6
+#define PIN_PAD4               7
 #define PIN_LEDGREEN           3
 #define PIN_LEDRED             4
 
@@ -11,57 +15,147 @@
 #define CMD_TIMEOUT            10000 //command timeout in milliseconds
 #define CMD_SET_SECRET         "set_secret"
 #define CMD_PING               "ping"
+#define CMD_STATION            "station"
+#define CMD_QUEUE_SECRET       "queue_secret"
+#define CMD_GENERATE_SECRETS   "generate_secrets"
 
 #define SECRETSIZE             8
 #define ADDRSIZE               8
+// the driver already retries every transaction DS1961_RETRIES times, a MAC
+// that is wrong after a write that went through isn't fixed by writing again
+#define WRITE_TRIES            1
 
 #define IBUTTON_SEARCH_TIMEOUT 60000 //timeout searching for ibutton
 
 OneWire ds(PIN_1WIRE);
 DS1961  ibutton(&ds);
 
+// Station mode keeps every pad polled, so a batch of buttons can be enrolled
+// by placing them on the pads one after the other, without a command per
+// button. Each new button gets the next secret from the queue filled by the
+// host, or a generated one, is verified with a challenge and is reported as
+// one id:secret line. The pads are polled round robin, one search per loop.
+// A search can miss a button that is still there, so a pad only counts as
+// empty after PAD_MISSES of them in a row. A button that was written on one
+// of the pads isn't written again when it comes back, until station is
+// turned on again.
+#ifndef PAD_COUNT
+#define PAD_COUNT              4
+#endif
+
+#define PAD_EMPTY              0   // searching for a button
+#define PAD_NOSECRET           1   // found a button, but there's no secret for it
+#define PAD_DONE               2   // waiting for the button to be removed
+#define PAD_MISSES             4   // failed searches in a row before a pad is empty
+
+#define SECRET_QUEUESIZE       8   // must be a power of two
+#define LED_TIME               500
+
+struct pad
+{
+  OneWire* bus;
+  DS1961*  ibutton;
+  uint8_t  state;
+  uint8_t  misses;
+  bool     written;  // addr is the last button this pad wrote a secret to
+  uint8_t  addr[ADDRSIZE];
+};
+
+#if PAD_COUNT > 1
+OneWire ds2(PIN_PAD2);
+DS1961  ibutton2(&ds2);
+#endif
+#if PAD_COUNT > 2
+OneWire ds3(PIN_PAD3);
+DS1961  ibutton3(&ds3);
+#endif
+#if PAD_COUNT > 3
+OneWire ds4(PIN_PAD4);
+DS1961  ibutton4(&ds4);
+#endif
+
+pad g_pads[PAD_COUNT] =
+{
+  { &ds, &ibutton, PAD_EMPTY, 0, false, {} },
+#if PAD_COUNT > 1
+  { &ds2, &ibutton2, PAD_EMPTY, 0, false, {} },
+#endif
+#if PAD_COUNT > 2
+  { &ds3, &ibutton3, PAD_EMPTY, 0, false, {} },
+#endif
+#if PAD_COUNT > 3
+  { &ds4, &ibutton4, PAD_EMPTY, 0, false, {} },
+#endif
+};
+
+bool     g_station = false;
+bool     g_generatesecrets = false;
+uint8_t  g_nextpad;
+uint32_t g_ledstarttime;
+
+uint8_t  g_secretqueue[SECRET_QUEUESIZE][SECRETSIZE];
+uint8_t  g_secrethead;
+uint8_t  g_secrettail;
+
 void setup()
 {
   Serial.begin(115200);
   Serial.println("DEBUG: Board started");
   pinMode(PIN_LEDGREEN, OUTPUT);
   pinMode(PIN_LEDRED, OUTPUT);
+
+  Entropy.initialize();
 }
 
-uint8_t ReadCMD(char* cmdbuf)
+char     g_cmdbuf[CMD_BUFSIZE];
+uint8_t  g_cmdbuffill;
+uint32_t g_cmdstarttime;
+
+// returns the length of a complete command in g_cmdbuf, or 0 while there is none
+uint8_t ReadCMD()
 {
-  uint32_t cmdstarttime;
-  uint8_t  cmdbuffill = 0;
-  for(;;)
+  while (Serial.available())
   {
-    if (Serial.available())
+    char input = Serial.read();
+    if (input == '\n')
     {
-      char input = Serial.read();
-      if (input == '\n')
-      {
-        cmdbuf[cmdbuffill] = 0;
-        return cmdbuffill;
-      }
-      else if (cmdbuffill < CMD_BUFSIZE - 1)
-      {
-        if (cmdbuffill == 0)
-          cmdstarttime = millis();
-
-        cmdbuf[cmdbuffill] = input;
-        cmdbuffill++;
-      }
+      uint8_t cmdbuffill = g_cmdbuffill;
+      g_cmdbuf[cmdbuffill] = 0;
+      g_cmdbuffill = 0;
+      return cmdbuffill;
     }
-    else if (cmdbuffill > 0 && millis() - cmdstarttime >= CMD_TIMEOUT)
+    else if (g_cmdbuffill < CMD_BUFSIZE - 1)
     {
-      Serial.println("ERROR: timeout receiving command");
-      return 0;
+      if (g_cmdbuffill == 0)
+        g_cmdstarttime = millis();
+
+      g_cmdbuf[g_cmdbuffill] = input;
+      g_cmdbuffill++;
     }
   }
+
+  if (g_cmdbuffill > 0 && millis() - g_cmdstarttime >= CMD_TIMEOUT)
+  {
+    Serial.println("ERROR: timeout receiving command");
+    g_cmdbuffill = 0;
+  }
+
+  return 0;
 }
 
-bool GetSecretFromBuf(char* cmdbuf, uint8_t cmdbuffill, uint8_t* secret)
+void PrintHex(const uint8_t* data, uint8_t size)
 {
-  uint8_t secretpos = strlen(CMD_SET_SECRET);
+  for (uint8_t i = 0; i < size; i++)
+  {
+    char buf[3];
+    snprintf(buf, sizeof(buf), "%02x", data[i]);
+    Serial.print(buf);
+  }
+}
+
+bool GetSecretFromBuf(char* cmdbuf, uint8_t cmdbuffill, const char* cmd, uint8_t* secret)
+{
+  uint8_t secretpos = strlen(cmd);
   while (cmdbuf[secretpos] == ' ' && secretpos < cmdbuffill)
     secretpos++;
 
@@ -98,6 +192,17 @@ bool GetSecretFromBuf(char* cmdbuf, uint8_t cmdbuffill, uint8_t* secret)
   return true;
 }
 
+// writes the secret and checks it with a random challenge, the way the lock
+// checks it, before the button leaves the pad
+bool WriteAndVerify(DS1961* ib, const uint8_t* addr, const uint8_t* secret, uint8_t tries)
+{
+  uint8_t nonce[3];
+  for (uint8_t i = 0; i < sizeof(nonce); i++)
+    nonce[i] = Entropy.randomByte();
+
+  return ib->WriteSecretVerified(addr, secret, nonce, tries);
+}
+
 void WriteSecretToButton(uint8_t* secret)
 {
   Serial.println("INFO: searching for iButton");
@@ -119,7 +224,7 @@ void WriteSecretToButton(uint8_t* secret)
       }
       Serial.print('\n');
 
-      if (ibutton.WriteSecret(addr, secret))
+      if (WriteAndVerify(&ibutton, addr, secret, WRITE_TRIES))
       {
         digitalWrite(PIN_LEDRED, LOW);
         digitalWrite(PIN_LEDGREEN, HIGH);
@@ -160,28 +265,229 @@ void WriteSecret(char* cmdbuf, uint8_t cmdbuffill)
   Serial.println("DEBUG: received set secret command");
 
   uint8_t secret[SECRETSIZE];
-  if (!GetSecretFromBuf(cmdbuf, cmdbuffill, secret))
+  if (!GetSecretFromBuf(cmdbuf, cmdbuffill, CMD_SET_SECRET, secret))
     return;
 
   WriteSecretToButton(secret);
-}
 
-void loop()
-{
   digitalWrite(PIN_LEDGREEN, LOW);
   digitalWrite(PIN_LEDRED, LOW);
+}
 
-  char     cmdbuf[CMD_BUFSIZE] = {};
-  uint8_t  cmdbuffill = ReadCMD(cmdbuf);
+void QueueSecret(char* cmdbuf, uint8_t cmdbuffill)
+{
+  uint8_t secret[SECRETSIZE];
+  if (!GetSecretFromBuf(cmdbuf, cmdbuffill, CMD_QUEUE_SECRET, secret))
+    return;
 
-  if (cmdbuffill == 0)
+  uint8_t next = (g_secrethead + 1) & (SECRET_QUEUESIZE - 1);
+  if (next == g_secrettail)
+  {
+    Serial.println("ERROR: secret queue is full");
     return;
+  }
+
+  memcpy(g_secretqueue[g_secrethead], secret, SECRETSIZE);
+  g_secrethead = next;
+}
+
+uint8_t QueuedSecrets()
+{
+  return (g_secrethead - g_secrettail) & (SECRET_QUEUESIZE - 1);
+}
+
+// gets the secret for the next button, a queued one is only taken off the
+// queue once it's written, so a failed write doesn't lose it
+bool NextSecret(uint8_t* secret, bool* fromqueue)
+{
+  *fromqueue = g_secrethead != g_secrettail;
+  if (*fromqueue)
+  {
+    memcpy(secret, g_secretqueue[g_secrettail], SECRETSIZE);
+    return true;
+  }
+  else if (g_generatesecrets)
+  {
+    for (uint8_t i = 0; i < SECRETSIZE; i++)
+      secret[i] = Entropy.randomByte();
+    return true;
+  }
 
-  if (strncasecmp(CMD_SET_SECRET, cmdbuf, strlen(CMD_SET_SECRET)) == 0)
-    WriteSecret(cmdbuf, cmdbuffill);
-  else if (strncasecmp(CMD_PING, cmdbuf, strlen(CMD_PING)) == 0)
-    Serial.println("pong");
+  return false;
+}
+
+void EnrollButton(uint8_t padnr, pad* p)
+{
+  uint8_t secret[SECRETSIZE];
+  bool    fromqueue;
+  if (!NextSecret(secret, &fromqueue))
+  {
+    if (p->state != PAD_NOSECRET)
+    {
+      Serial.print("INFO: no secret for the button on pad ");
+      Serial.println(padnr, DEC);
+      p->state = PAD_NOSECRET;
+    }
+    return;
+  }
+
+  Serial.print("INFO: writing secret to the button on pad ");
+  Serial.println(padnr, DEC);
+
+  p->state = PAD_DONE;
+  g_ledstarttime = millis();
+
+  if (WriteAndVerify(p->ibutton, p->addr, secret, WRITE_TRIES))
+  {
+    p->written = true;
+    if (fromqueue)
+      g_secrettail = (g_secrettail + 1) & (SECRET_QUEUESIZE - 1);
+
+    digitalWrite(PIN_LEDRED, LOW);
+    digitalWrite(PIN_LEDGREEN, HIGH);
+
+    PrintHex(p->addr, ADDRSIZE);
+    Serial.print(':');
+    PrintHex(secret, SECRETSIZE);
+    Serial.print('\n');
+    return;
+  }
+
+  digitalWrite(PIN_LEDGREEN, LOW);
+  digitalWrite(PIN_LEDRED, HIGH);
+  Serial.print("ERROR: writing secret failed on pad ");
+  Serial.println(padnr, DEC);
+}
+
+// true if one of the pads wrote this button last, so it already has a secret
+bool WrittenBefore(const uint8_t* addr)
+{
+  for (uint8_t i = 0; i < PAD_COUNT; i++)
+  {
+    if (g_pads[i].written && memcmp(addr, g_pads[i].addr, ADDRSIZE) == 0)
+      return true;
+  }
+
+  return false;
+}
+
+void StationProcess()
+{
+  uint8_t padnr = g_nextpad;
+  pad*    p = &g_pads[padnr];
+  g_nextpad = (g_nextpad + 1) % PAD_COUNT;
+
+  uint8_t addr[ADDRSIZE];
+  p->bus->reset_search();
+  if (!p->bus->search(addr) || OneWire::crc8(addr, 7) != addr[7])
+  {
+    if (p->misses < PAD_MISSES)
+      p->misses++;
+    if (p->misses == PAD_MISSES)
+      p->state = PAD_EMPTY;
+  }
+  else if (p->state != PAD_EMPTY && memcmp(addr, p->addr, ADDRSIZE) == 0)
+  {
+    p->misses = 0;
+    if (p->state == PAD_NOSECRET)
+      EnrollButton(padnr, p);
+  }
+  else if (WrittenBefore(addr))
+  {
+    p->misses = 0;
+    if (memcmp(addr, p->addr, ADDRSIZE) != 0)
+    {
+      memcpy(p->addr, addr, ADDRSIZE);
+      p->written = false;
+    }
+    p->state = PAD_DONE;
+    Serial.print("INFO: the button on pad ");
+    Serial.print(padnr, DEC);
+    Serial.println(" already has its secret");
+  }
   else
-    Serial.println("unknown command");
+  {
+    p->misses = 0;
+    p->written = false;
+    memcpy(p->addr, addr, ADDRSIZE);
+    p->state = PAD_EMPTY;
+    EnrollButton(padnr, p);
+  }
+
+  if (millis() - g_ledstarttime >= LED_TIME)
+  {
+    digitalWrite(PIN_LEDGREEN, LOW);
+    digitalWrite(PIN_LEDRED, LOW);
+  }
+}
+
+void SetStation(char* cmdbuf)
+{
+  char* arg = cmdbuf + strlen(CMD_STATION);
+  while (*arg == ' ')
+    arg++;
+
+  if (strncasecmp(arg, "on", 2) == 0)
+  {
+    for (uint8_t i = 0; i < PAD_COUNT; i++)
+    {
+      g_pads[i].state = PAD_EMPTY;
+      g_pads[i].misses = PAD_MISSES;
+      g_pads[i].written = false;
+    }
+    g_station = true;
+  }
+  else if (strncasecmp(arg, "off", 3) == 0)
+  {
+    g_station = false;
+    digitalWrite(PIN_LEDGREEN, LOW);
+    digitalWrite(PIN_LEDRED, LOW);
+  }
+
+  Serial.print("INFO: station ");
+  Serial.print(g_station ? "on" : "off");
+  Serial.print(", ");
+  Serial.print(QueuedSecrets(), DEC);
+  Serial.print(" secrets queued, generating ");
+  Serial.println(g_generatesecrets ? "on" : "off");
+}
+
+void SetGenerateSecrets(char* cmdbuf)
+{
+  char* arg = cmdbuf + strlen(CMD_GENERATE_SECRETS);
+  while (*arg == ' ')
+    arg++;
+
+  if (strncasecmp(arg, "on", 2) == 0)
+    g_generatesecrets = true;
+  else if (strncasecmp(arg, "off", 3) == 0)
+    g_generatesecrets = false;
+
+  Serial.print("INFO: generating secrets ");
+  Serial.println(g_generatesecrets ? "on" : "off");
+}
+
+void loop()
+{
+  uint8_t cmdbuffill = ReadCMD();
+  if (cmdbuffill > 0)
+  {
+    char* cmdbuf = g_cmdbuf;
+    if (strncasecmp(CMD_SET_SECRET, cmdbuf, strlen(CMD_SET_SECRET)) == 0)
+      WriteSecret(cmdbuf, cmdbuffill);
+    else if (strncasecmp(CMD_QUEUE_SECRET, cmdbuf, strlen(CMD_QUEUE_SECRET)) == 0)
+      QueueSecret(cmdbuf, cmdbuffill);
+    else if (strncasecmp(CMD_GENERATE_SECRETS, cmdbuf, strlen(CMD_GENERATE_SECRETS)) == 0)
+      SetGenerateSecrets(cmdbuf);
+    else if (strncasecmp(CMD_STATION, cmdbuf, strlen(CMD_STATION)) == 0)
+      SetStation(cmdbuf);
+    else if (strncasecmp(CMD_PING, cmdbuf, strlen(CMD_PING)) == 0)
+      Serial.println("pong");
+    else
+      Serial.println("unknown command");
+  }
+
+  if (g_station)
+    StationProcess();
 }
 
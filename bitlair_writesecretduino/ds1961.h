@@ -6,6 +6,22 @@
 
 #include "OneWire.h"
 
+// extra tries after a failed ReadAuthWithChallenge() or WriteSecret(), a
+// marginal contact usually comes through on the next one
+#ifndef DS1961_RETRIES
+#define DS1961_RETRIES 2
+#endif
+
+// failures on the bus since the last ResetStats()
+struct ds1961stats
+{
+  uint16_t presence;   // no presence pulse after a reset
+  uint16_t crc;        // a CRC16 that didn't match
+  uint16_t status;     // a wrong status or separator byte
+  uint16_t retries;    // tries after the first
+  uint16_t failures;   // operations that failed on every try
+};
+
 class DS1961 {
 
 public:
@@ -15,8 +31,24 @@ public:
   bool ReadAuthWithChallenge(const uint8_t id[8], uint16_t addr, const uint8_t challenge[3], uint8_t data[32], uint8_t mac[20]);
   bool WriteData(const uint8_t id[8], int addr, const uint8_t data[8], const uint8_t mac[20]);
 
+  // writes the secret and checks it with an authenticated read of page 0,
+  // writing it again up to tries times while the button is still selected
+  bool WriteSecretVerified(const uint8_t id[8], const uint8_t secret[8], const uint8_t challenge[3], uint8_t tries);
+
+  // the MAC a button with this secret returns from ReadAuthWithChallenge()
+  // for data and challenge, in the same byte order
+  static void ComputeMAC(const uint8_t id[8], const uint8_t secret[8], const uint8_t data[32], const uint8_t challenge[3], uint8_t mac[20]);
+
+  void SetRetries(uint8_t retries);
+  void GetStats(ds1961stats* stats);
+  void ResetStats();
+
 private:
   OneWire *ow;
+  uint8_t retries;
+  ds1961stats stats;
+
+  void CountError();
 
 };
 
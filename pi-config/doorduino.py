@@ -19,6 +19,8 @@ import syslog
 import csv
 import git
 
+from eventseq import EventSequence
+
 import logging
 from paho.mqtt import client as mqtt_client
 
@@ -144,6 +146,59 @@ def mqtt_thread():
 
     client.loop_forever()
 
+def send_command(command):
+    global ser
+    ser.write(b"\n")
+    ser.write(command.encode('ascii') + b"\n")
+
+# event <seq> <millis> <name> <arg>, see bitlair_doorduino/src/events.h
+def request_replay(first):
+    print("Missed events from %d, requesting replay" % first)
+    send_command("replay_since %d" % first)
+
+def report_lost(first, last):
+    log("Lost events %d-%d" % (first, last))
+
+events = EventSequence(request_replay, report_lost)
+events_seen = False
+def handle_event(fields):
+    global events_seen
+
+    try:
+        seq, ms, name, arg = int(fields[1]), int(fields[2]), fields[3], int(fields[4])
+    except (IndexError, ValueError):
+        print("Malformed event: " + ' '.join(fields))
+        return
+
+    events_seen = True
+    for event in events.receive(seq, name, (seq, ms, name, arg)):
+        handle_ordered_event(*event)
+
+def handle_ordered_event(seq, ms, name, arg):
+    global config
+
+    print("Event %d at %d ms: %s %d" % (seq, ms, name, arg))
+
+    if name == "horn_on":
+        log("Horn activated")
+        mqtt(config, config.get('mqtt','doorbell.subject'), '1', False)
+    elif name == "horn_off":
+        log("Horn released after %d ms" % arg)
+        mqtt(config, config.get('mqtt','doorbell.subject'), '0', False)
+    elif name == "solenoid_on":
+        log("Solenoid activated")
+        mqtt(config, config.get('mqtt','dooropen.subject'), '1', False)
+        time.sleep(2)
+        mqtt(config, config.get('mqtt','dooropen.subject'), '0', False)
+    elif name == "auth_ok":
+        log("iButton authenticated on reader %d" % arg)
+    elif name == "lock_opening":
+        log("lock open")
+        mqtt(config, config.get('mqtt','lockstate.subject'), 'open', True)
+    elif name == "lock_closing":
+        log("lock closed")
+        mqtt(config, config.get('mqtt','lockstate.subject'), 'closed', True)
+
 buttons = []
 def serial_monitor_thread():
     global ser
@@ -161,7 +216,11 @@ def serial_monitor_thread():
                 action = data.decode("iso-8859-1").strip()
 
                 print("Data:" + action)
-                if action == "Horn activated":
+                if action[:6] == "event ":
+                    handle_event(action.split(' '))
+                elif events_seen and action in ("Horn activated", "Solenoid activated", "iButton authenticated", "opening lock", "closing lock"):
+                    pass # handled through the event stream
+                elif action == "Horn activated":
                     print("Horn activated")
                     log("Horn activated")
                     mqtt(config, config.get('mqtt','doorbell.subject'), '1', False)
@@ -0,0 +1,70 @@
+# Puts the event lines of the doorduino back in order of seq, see
+# bitlair_doorduino/src/events.h.
+#
+# A gap in seq means lines were lost on the serial port. The events after the
+# gap are held back, and the doorduino is asked to send the missing ones
+# again with replay_since. A replay resends everything from there on in
+# order, so once a replayed event comes in, whatever is still missing before
+# it is gone for good. The held events are then handed out in order, so a
+# lock_opening that was replayed is never handled after the lock_closing
+# that came live after it.
+
+# the doorduino keeps this many events for replays
+EVENT_RINGSIZE = 16
+
+
+class EventSequence:
+    def __init__(self, request_replay, report_lost):
+        self.request_replay = request_replay # called with the first missing seq
+        self.report_lost = report_lost       # called with the first and last seq that are gone
+        self.last = 0     # seq of the last event handed out
+        self.highest = 0  # highest seq that came in
+        self.held = {}
+
+    # returns the events that can be handled now, in order
+    def receive(self, seq, name, event):
+        ready = []
+        if name == "boot":
+            # the doorduino restarted, what it didn't resend is gone
+            self.release(ready, self.highest + 1)
+            self.last = 0
+            self.highest = 0
+
+        if seq <= self.last or seq in self.held:
+            # resent by a replay, everything missing before it won't come
+            self.release(ready, seq)
+            return ready
+
+        if self.last == 0 and not self.held:
+            self.last = seq - 1
+        elif seq > self.highest + 1:
+            self.request_replay(self.highest + 1)
+
+        if seq > self.highest:
+            self.highest = seq
+            self.held[seq] = event
+            if len(self.held) > EVENT_RINGSIZE:
+                # the replay never came, the doorduino no longer has them
+                self.release(ready, min(self.held))
+        else:
+            self.held[seq] = event
+            self.release(ready, seq)
+
+        self.release(ready)
+        return ready
+
+    # hands out the held events in order, up to before, the ones missing
+    # below it are reported lost
+    def release(self, ready, before=None):
+        while True:
+            if self.last + 1 in self.held:
+                self.last += 1
+                ready.append(self.held.pop(self.last))
+            elif before is not None and self.last + 1 < before:
+                first = self.last + 1
+                following = [seq for seq in self.held if seq > first]
+                end = min(following + [before])
+                self.report_lost(first, end - 1)
+                self.last = end - 1
+            else:
+                break
@@ -0,0 +1,87 @@
+#!/usr/bin/python3
+
+# python3 -m unittest test_eventseq
+
+import unittest
+
+from eventseq import EventSequence, EVENT_RINGSIZE
+
+
+class EventSequenceTest(unittest.TestCase):
+    def setUp(self):
+        self.replays = []
+        self.lost = []
+        self.events = EventSequence(self.replays.append, lambda first, last: self.lost.append((first, last)))
+
+    def receive(self, *seqs, name="horn_on"):
+        handled = []
+        for seq in seqs:
+            handled += self.events.receive(seq, name, seq)
+        return handled
+
+    def test_in_order(self):
+        self.assertEqual(self.receive(1, 2, 3), [1, 2, 3])
+        self.assertEqual(self.replays, [])
+        self.assertEqual(self.lost, [])
+
+    def test_starts_anywhere(self):
+        # the host can start while the doorduino is long up
+        self.assertEqual(self.receive(57, 58), [57, 58])
+        self.assertEqual(self.replays, [])
+
+    def test_duplicate(self):
+        self.assertEqual(self.receive(1, 2, 2, 1), [1, 2])
+        self.assertEqual(self.lost, [])
+
+    def test_gap_then_replay(self):
+        self.assertEqual(self.receive(1, 2, 5), [1, 2])
+        self.assertEqual(self.replays, [3])
+        # a live event comes in before the replay does
+        self.assertEqual(self.receive(6), [])
+        # replay_since 3 resends 3 to 6
+        self.assertEqual(self.receive(3, 4), [3, 4, 5, 6])
+        self.assertEqual(self.receive(5, 6), [])
+        self.assertEqual(self.receive(7), [7])
+        self.assertEqual(self.lost, [])
+
+    def test_replay_without_some(self):
+        self.assertEqual(self.receive(1, 2, 6, 7), [1, 2])
+        self.assertEqual(self.replays, [3])
+        # 3 and 4 were overwritten in the ring of the doorduino
+        self.assertEqual(self.receive(5), [5, 6, 7])
+        self.assertEqual(self.lost, [(3, 4)])
+        self.assertEqual(self.receive(6, 7, 8), [8])
+
+    def test_replay_of_held_only(self):
+        self.assertEqual(self.receive(1, 4, 5), [1])
+        # only what was held came back
+        self.assertEqual(self.receive(4, 5), [4, 5])
+        self.assertEqual(self.lost, [(2, 3)])
+
+    def test_two_gaps(self):
+        self.assertEqual(self.receive(1, 3, 5), [1])
+        self.assertEqual(self.replays, [2, 4])
+        self.assertEqual(self.receive(2, 3, 4, 5), [2, 3, 4, 5])
+        self.assertEqual(self.receive(2, 3, 4, 5), [])
+        self.assertEqual(self.lost, [])
+
+    def test_replay_never_comes(self):
+        self.assertEqual(self.receive(1, 3), [1])
+        handled = self.receive(*range(4, 4 + EVENT_RINGSIZE))
+        self.assertEqual(handled, list(range(3, 4 + EVENT_RINGSIZE)))
+        self.assertEqual(self.lost, [(2, 2)])
+
+    def test_boot(self):
+        self.assertEqual(self.receive(1, 2, 3), [1, 2, 3])
+        self.assertEqual(self.receive(1, name="boot"), [1])
+        self.assertEqual(self.receive(2), [2])
+        self.assertEqual(self.replays, [])
+
+    def test_boot_while_held(self):
+        self.assertEqual(self.receive(1, 2, 4), [1, 2])
+        self.assertEqual(self.receive(1, name="boot"), [4, 1])
+        self.assertEqual(self.lost, [(3, 3)])
+
+
+if __name__ == '__main__':
+    unittest.main()